@@ -8,6 +8,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
 // Needed on MsWindows
@@ -15,6 +16,14 @@
 #endif // Win32 platform
 
 #include <vector>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <unordered_map>
 #include <OpenGL/gl.h>
 #include "float2.h"
 #include <OpenGL/glu.h>
@@ -30,406 +39,651 @@ bool deletingPoints = false;
 bool movingAPoint = false;
 int currSelectedCurve;
 int controlPointVal;
+bool rubberBanding = false;
+bool translatingSelection = false;
+bool rotatingSelection = false;
+bool scalingSelection = false;
+bool draggingSelection = false;
+float2 dragStart;
+float2 lastMousePosition;
 
-/**
-Curve class: Defines a virtual curve that the curves in this project inherit from
- */
-class Curve {
-    
-public:
-    //draw each curve in its own unique color
-    int curveType;
-    
-    Curve(int curveType) : curveType(curveType) {}
-//    double color1 = ((double) rand() / (RAND_MAX));
-//    double color2 = ((double) rand() / (RAND_MAX));
-//    double color3 = ((double) rand() / (RAND_MAX));
-    double color1, color2, color3;
-    bool selected = false;
+std::vector<Freeform*> curves;
+Freeform *selectedCurve;
+//with compact storage, curves keep their control points quantized and scene files are written in the compact binary format
+bool compactStorage = false;
 
+//this class manages all the objects. we store object pointers.
+class CurvesContainer
+{
+public:
 
-    int getCurveType() {
-        return curveType;
-    }
-    
-    virtual float2 getPoint(float t)=0;
-    
-    void setSelected() {
-        selected = true;
+    //registers an object in this countainer
+    void addCurve(Freeform* curve) {
+        curve->setCompactStorage(compactStorage);
+        curves.push_back(curve);
     }
-    
-    void setUnSelected() {
-        selected = false;
+    //releases all the objects stored in the object container. we only need to do this with objects created with "new"
+    CurvesContainer() {
+        for(unsigned int i=0; i<curves.size(); i++)
+            delete curves.at(i);
     }
-    
-    //virtual method, since draw in Polyline overrides it
-    virtual void draw(){
-        
+    //vertices and colors of all curve strokes, kept between frames and only updated where a stroke changed
+    std::vector<float2> strokeVertices;
+    std::vector<float> strokeColors;
 
-        
-        //if curve is selected, draw it in blue with double width
-        if (selected) {
-            glColor3d(0.0, 0.0, 1.0);
-            glLineWidth(6);
+    //where each curve's stroke sits in the batch, and the stroke version and color it was copied with
+    struct StrokeRange {
+        Freeform* curve;
+        unsigned int version;
+        float color[3];
+        unsigned int offset, size;
+    };
+    std::vector<StrokeRange> strokeRanges;
+
+    //copies a curve's stroke and color into its range of the batch, together with the two joining vertices next to it,
+    //which repeat the stroke's first and last vertex
+    void writeStrokeRange(const StrokeRange& range, const std::vector<float2>& stroke) {
+        unsigned int first = range.offset > 0 ? range.offset - 1 : 0;
+        unsigned int last = range.offset + range.size < strokeVertices.size() ? range.offset + range.size : range.offset + range.size - 1;
+        for (unsigned int j = first; j <= last; j++) {
+            strokeVertices[j] = stroke[j < range.offset ? 0 : (j >= range.offset + range.size ? range.size - 1 : j - range.offset)];
+            for (int k = 0; k < 3; k++) {
+                strokeColors[3 * j + k] = range.color[k];
+            }
         }
-        
-        //else, draw in a random color
-        else {
-            //polyline coloring taken care of in polyline class
-            if (curveType ==1.0) {
-                color1 = 0.2;
-                color2 = 0.9;
-                color3 = 0.2;
+    }
+
+    //lays out all strokes in one triangle strip. each curve's stroke is joined to the previous one by repeating a vertex
+    //at each end, which makes degenerate triangles that draw nothing
+    void rebuildStrokeBatch(float2 pixelsPerUnit) {
+        strokeRanges.resize(curves.size());
+        std::vector<const std::vector<float2>*> strokes(curves.size());
+        unsigned int total = 0;
+        for (unsigned int i = 0; i < curves.size(); i++) {
+            StrokeRange& range = strokeRanges[i];
+            range.curve = curves.at(i);
+            float width = range.curve->getStrokeStyle(range.color);
+            strokes[i] = &range.curve->getStroke(width, pixelsPerUnit);
+            range.size = strokes[i]->size();
+            range.version = range.curve->getStrokeVersion();
+            if (range.size > 0) {
+                range.offset = total > 0 ? total + 2 : 0;
+                total = range.offset + range.size;
             }
-            //lagrange coloring
-            else {
-                color1 = 1.0;
-                color2 = 0.4;
-                color3 = 0.7;
+        }
+        strokeVertices.resize(total);
+        strokeColors.resize(3 * total);
+        for (unsigned int i = 0; i < strokeRanges.size(); i++) {
+            if (strokeRanges[i].size > 0) {
+                writeStrokeRange(strokeRanges[i], *strokes[i]);
             }
+        }
+    }
 
-            
-            glColor3d(color1, color2, color3);
-            glLineWidth(3);
+    //draws all the objects in the container as one triangle strip. strokes are cached by the curves, and the batch only
+    //copies the ones whose version or color changed. it is laid out again when curves are added, removed or resampled
+    void draw() {
+        int viewportRect[4];
+        glGetIntegerv(GL_VIEWPORT, viewportRect);
+        float2 pixelsPerUnit(viewportRect[2] / 2.0f, viewportRect[3] / 2.0f);
+        bool layoutChanged = strokeRanges.size() != curves.size();
+        for (unsigned int i = 0; i < curves.size() && !layoutChanged; i++) {
+            StrokeRange& range = strokeRanges[i];
+            float color[3];
+            float width = curves.at(i)->getStrokeStyle(color);
+            const std::vector<float2>& stroke = curves.at(i)->getStroke(width, pixelsPerUnit);
+            if (range.curve != curves.at(i) || range.size != stroke.size()) {
+                layoutChanged = true;
+            }
+            else if (range.version != curves.at(i)->getStrokeVersion() || color[0] != range.color[0] || color[1] != range.color[1] || color[2] != range.color[2]) {
+                range.version = curves.at(i)->getStrokeVersion();
+                range.color[0] = color[0]; range.color[1] = color[1]; range.color[2] = color[2];
+                if (range.size > 0) {
+                    writeStrokeRange(range, stroke);
+                }
+            }
         }
-        
-        glBegin(GL_LINE_STRIP);
-        for (float i = 0; i < 1; i+=.01) {
-            float2 point = getPoint(i);
-            float x = point.x;
-            float y = point.y;
-            glVertex2d(x, y);
+        if (layoutChanged) {
+            rebuildStrokeBatch(pixelsPerUnit);
         }
-        glEnd();
-    };
-
-    //mouseOverCurve: takes in cursor position and returns true if mouse is over current curve
-    //input: current x and y position of the mouse
-    //output: True if mouse is over this curve, false otherwise.
-    virtual bool mouseOverCurve(float mouseX, float mouseY) {
-
-        for (float i = 0; i < 1; i+=.01) {
-            //get each point
-            float2 point = getPoint(i);
-            float pointX = point.x;
-            float pointY = point.y;
-
-            //difference between mouseX and that point x
-            float differenceBetweenX = mouseX - pointX;
-            float differenceBetweenY = mouseY - pointY;
-            
-            //if the difference is marginal, return true. else return false
-            if (fabs(differenceBetweenX) < .05 && fabs(differenceBetweenY) < .05) {
-                return true;
+        if (strokeVertices.empty()) {
+            return;
+        }
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(float2), &strokeVertices[0].x);
+        glColorPointer(3, GL_FLOAT, 0, &strokeColors[0]);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, strokeVertices.size());
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+    void drawControlPoints() {
+        for(unsigned int i=0; i<curves.size(); i++) {
+            curves.at(i)->drawControlPoints();
+        }
+    }
+    int checkMouseCurves(float x, float y) {
+        for (unsigned int i = 0; i < curves.size(); i++ ) {
+            if (curves.at(i)->mouseOverCurve(x, y)) {
+                return i;
             }
         }
-        return false;
+        return -1;
     }
-};
 
+    //multi-selection: the curves picked by the last rubber band drag
+    std::vector<Freeform*> selection;
 
-/**
-Freeform class. Contains additional methods for dealing with control points: getting, setting, replacing, deleting, drawing.
- */
-class Freeform : public Curve
-{
+    //records of the selected curves when the current drag started, and the transform applied since then. every motion
+    //step transforms these records, so compact control points don't pick up rounding errors over a long drag
+    std::vector<CurveRecordPtr> dragOrigins;
+    AffineTransform dragTransform = AffineTransform::translation(float2(0.0, 0.0));
 
-protected:
-    std::vector<float2> controlPoints;
-    std::vector<int> controlPointsNearClick;
-    
-public:
-    
-    Freeform(int curveType) : Curve(curveType) {}
+    //selections at least this large are transformed on several threads
+    static const unsigned int parallelTransformThreshold = 2048;
 
-    virtual float2 getPoint(float t)=0;
-    
-    virtual void addControlPoint(float2 p)
-    {
-        controlPoints.push_back(p);
+    void clearSelection() {
+        for (unsigned int i = 0; i < selection.size(); i++) {
+            selection.at(i)->inSelection = false;
+        }
+        selection.clear();
+        dragOrigins.clear();
     }
-    
-    float2* getControlPoint(int index) {
-        return &controlPoints.at(index);
+
+    //removes a single curve from the selection, e.g. before it is erased from curves
+    void deselect(Freeform* curve) {
+        for (unsigned int i = 0; i < selection.size(); i++) {
+            if (selection.at(i) == curve) {
+                curve->inSelection = false;
+                selection.erase(selection.begin() + i);
+                dragOrigins.clear();
+                return;
+            }
+        }
     }
-    
-    void setNewControlPointValue(int index, float2 newValue) {
-        controlPoints.at(index) = newValue;
+
+    void startSelectionDrag() {
+        dragOrigins.clear();
+        for (unsigned int i = 0; i < selection.size(); i++) {
+            dragOrigins.push_back(selection.at(i)->freeze());
+        }
+        dragTransform = AffineTransform::translation(float2(0.0, 0.0));
     }
-    
-    virtual void eraseControlPoint(int point) {
-        controlPoints.erase(controlPoints.begin() + point);
-    }//override in lagrange
-    
-    void drawControlPoints(){
-        if (selected) {
-            glBegin(GL_POINTS);
-            for (float i = 0; i < controlPoints.size(); i++) {
-                float2 point = controlPoints.at(i);
-                float x = point.x;
-                float y = point.y;
-                glVertex2d(x, y);
-                
+
+    void endSelectionDrag() {
+        dragOrigins.clear();
+    }
+
+    //replaces the selection with every curve that passes through the rectangle spanned by the two corners
+    void selectInRectangle(float2 corner1, float2 corner2) {
+        clearSelection();
+        float2 lo(fminf(corner1.x, corner2.x), fminf(corner1.y, corner2.y));
+        float2 hi(fmaxf(corner1.x, corner2.x), fmaxf(corner1.y, corner2.y));
+        for (unsigned int i = 0; i < curves.size(); i++) {
+            if (curves.at(i)->intersectsRectangle(lo, hi)) {
+                curves.at(i)->inSelection = true;
+                selection.push_back(curves.at(i));
             }
-            glEnd();
         }
     }
-    
-    int getControlPointsSize() {
-        return controlPoints.size();
+
+    //average of the selected control points, used as pivot for rotating and scaling
+    float2 getSelectionCenter() {
+        float2 sum(0.0, 0.0);
+        int count = 0;
+        for (unsigned int i = 0; i < selection.size(); i++) {
+            for (int j = 0; j < selection.at(i)->getControlPointsSize(); j++) {
+                sum += selection.at(i)->getControlPoint(j);
+                count++;
+            }
+        }
+        if (count == 0) {
+            return sum;
+        }
+        return sum * (1.0f / count);
     }
-    
-    //get closest control point to mouse
-    //returns point that's closest or -1 if no point is close enough
-    int getControlPointNearMouse(float x, float y) {
-        for (int i = 0; i < controlPoints.size(); i++) {
-            float ctrlPtX = controlPoints.at(i).x;
-            float ctrlPtY = controlPoints.at(i).y;
-            
-            //if difference is marginal, return that control point. else return -1
-            if ((fabs(ctrlPtX - x) < 0.05f && fabs(ctrlPtY - y) < 0.05f)) {
-                return i;
+
+    void transformSelectionRange(const AffineTransform& transform, size_t begin, size_t end) {
+        bool fromOrigins = dragOrigins.size() == selection.size();
+        for (size_t i = begin; i < end; i++) {
+            if (fromOrigins) {
+                selection[i]->transformControlPoints(*dragOrigins[i], dragTransform, transform);
+            }
+            else {
+                selection[i]->transformControlPoints(transform);
             }
         }
-        return -1;
     }
+
+    //applies transform to all selected curves. large selections are split into contiguous chunks, one per hardware thread
+    void transformSelection(const AffineTransform& transform) {
+        dragTransform = dragTransform.then(transform);
+        unsigned int threadCount = std::thread::hardware_concurrency();
+        if (selection.size() < parallelTransformThreshold || threadCount < 2) {
+            transformSelectionRange(transform, 0, selection.size());
+            return;
+        }
+        std::vector<std::thread> workers;
+        size_t chunkSize = (selection.size() + threadCount - 1) / threadCount;
+        for (size_t begin = 0; begin < selection.size(); begin += chunkSize) {
+            size_t end = begin + chunkSize < selection.size() ? begin + chunkSize : selection.size();
+            workers.push_back(std::thread(&CurvesContainer::transformSelectionRange, this, std::cref(transform), begin, end));
+        }
+        for (unsigned int i = 0; i < workers.size(); i++) {
+            workers.at(i).join();
+        }
+    }
+
 };
-std::vector<Freeform*> curves;
+CurvesContainer curvesContainer;
+int globalCounter = -1;
 
 /**
- Polyline class: draws a new polyline where control points are clicked.
+ SceneSnapshot: immutable version of the whole scene, stored as a tree whose leaves hold the curve records in order.
+ A node ends where the hash of an entry says so rather than at a fixed position, so inserting or erasing curves only
+ changes the nodes around the edit. A new snapshot finds every other node in the previous one and shares it, which makes
+ an undo step cost memory proportional to what was edited, wherever in the scene that was.
  */
-class Polyline : public Freeform {
+class SceneSnapshot {
 public:
-   // curveType = 0;
-    Polyline() : Freeform(0.0) {}
-    
-    float2 getPoint(float t) {
-        return float2(0.0, 0.0);
-    }
+    struct Node {
+        //leaves hold records, inner nodes hold children
+        std::vector<CurveRecordPtr> records;
+        std::vector<std::shared_ptr<const Node> > children;
+    };
+    typedef std::shared_ptr<const Node> NodePtr;
+    //nodes of a previous snapshot by the address of their first entry
+    typedef std::unordered_map<const void*, NodePtr> NodeIndex;
 
-    void addControlPoint(float2 p)
-    {
-        controlPoints.push_back(p);
+    //a node ends after an entry whose hash is 0 modulo averageNodeSize, but holds at least minNodeSize entries so every
+    //level of the tree is smaller than the one below, and at most maxNodeSize
+    static const unsigned int averageNodeSize = 32;
+    static const unsigned int minNodeSize = 4;
+    static const unsigned int maxNodeSize = 128;
+
+    NodePtr root;
+    size_t curveCount = 0;
+
+    static bool endsNode(const void* entry) {
+        uint64_t hash = (uint64_t)(uintptr_t)entry * 0x9E3779B97F4A7C15ull;
+        return (hash >> 32) % averageNodeSize == 0;
     }
-    
-    //like drawControlPoints
-    void draw(){
-        if (selected) {
-            glColor3d(0.0, 0.0, 1.0);
-            glLineWidth(6);
+
+    static void indexNodes(const NodePtr& node, NodeIndex& index) {
+        if (node->records.empty()) {
+            index[node->children.front().get()] = node;
+            for (unsigned int i = 0; i < node->children.size(); i++) {
+                indexNodes(node->children[i], index);
+            }
         }
-        
         else {
-            glColor3d(0.6, 0.1, 0.8);
-            glLineWidth(3);
+            index[node->records.front().get()] = node;
         }
-        glBegin(GL_LINE_STRIP);
-        
-        for (float i = 0; i < controlPoints.size(); i++) {
-            float2 point = controlPoints.at(i);
-            float x = point.x;
-            float y = point.y;
-            glVertex2d(x, y);
-            
+    }
+
+    static NodePtr makeNode(const std::vector<CurveRecordPtr>& records, const NodeIndex& previousNodes) {
+        NodeIndex::const_iterator match = previousNodes.find(records.front().get());
+        if (match != previousNodes.end() && match->second->records == records) {
+            return match->second;
         }
-        glEnd();
-    };
-    
-    //check if mouse is over curve. since we don't have a getPoint function for polyline, have to do this a little differently
-    bool mouseOverCurve(float mouseX, float mouseY) {
-        for (int i = 0; i < controlPoints.size() -1; i++) {
-            bool doesPointExist = pointBetweenCtrlPoints(controlPoints.at(i), controlPoints.at(i+1), mouseX, mouseY);
-            if (doesPointExist) {
-                return true;
+        std::shared_ptr<Node> node = std::make_shared<Node>();
+        node->records = records;
+        return node;
+    }
+
+    static NodePtr makeNode(const std::vector<NodePtr>& children, const NodeIndex& previousNodes) {
+        NodeIndex::const_iterator match = previousNodes.find(children.front().get());
+        if (match != previousNodes.end() && match->second->children == children) {
+            return match->second;
+        }
+        std::shared_ptr<Node> node = std::make_shared<Node>();
+        node->children = children;
+        return node;
+    }
+
+    //groups entries into the nodes of the next level up
+    template <typename Entry>
+    static void buildLevel(const std::vector<Entry>& entries, const NodeIndex& previousNodes, std::vector<NodePtr>& out) {
+        std::vector<Entry> group;
+        for (size_t i = 0; i < entries.size(); i++) {
+            group.push_back(entries[i]);
+            if ((group.size() >= minNodeSize && endsNode(entries[i].get())) || group.size() == maxNodeSize || i + 1 == entries.size()) {
+                out.push_back(makeNode(group, previousNodes));
+                group.clear();
             }
         }
-        return false;
     }
-    
-    
-    //idea for equation from: http://stackoverflow.com/questions/328107/how-can-you-determine-a-point-is-between-two-other-points-on-a-line-segment
-    bool pointBetweenCtrlPoints(float2 ctrlPoint1, float2 ctrlPoint2, float mouseX, float mouseY) {
-        //first, check if cross product of (b-a) and (c-a) is 0
-        float crossProduct = (mouseY - ctrlPoint1.y) * (ctrlPoint2.x - ctrlPoint1.x) - (mouseX - ctrlPoint1.x) * (ctrlPoint2.y - ctrlPoint1.y);
-        if (fabs(crossProduct) > 0.05){
-            return false;
+
+    static std::shared_ptr<const SceneSnapshot> capture(const std::vector<Freeform*>& curves, const SceneSnapshot* previous) {
+        std::shared_ptr<SceneSnapshot> snapshot = std::make_shared<SceneSnapshot>();
+        snapshot->curveCount = curves.size();
+        NodeIndex previousNodes;
+        if (previous != NULL && previous->root) {
+            indexNodes(previous->root, previousNodes);
         }
-        
-        //next, check if dot product is positive
-        float dotProduct = (mouseX - ctrlPoint1.x) * (ctrlPoint2.x - ctrlPoint1.x) + (mouseY - ctrlPoint1.y)*(ctrlPoint2.y - ctrlPoint1.y);
-        if (dotProduct < 0) {
-            return false;
+        std::vector<CurveRecordPtr> records;
+        records.reserve(curves.size());
+        for (size_t i = 0; i < curves.size(); i++) {
+            records.push_back(curves[i]->freeze());
         }
-        
-        //now, check that dot product is less than square of distance between ctrlPoint1 and ctrlPoint2
-        float lengthSquared = (ctrlPoint2.x - ctrlPoint1.x) * (ctrlPoint2.x - ctrlPoint1.x) + (ctrlPoint2.y - ctrlPoint1.y) * (ctrlPoint2.y - ctrlPoint1.y);
-        if (dotProduct > lengthSquared) {
-            return false;
+        std::vector<NodePtr> level;
+        buildLevel(records, previousNodes, level);
+        while (level.size() > 1) {
+            std::vector<NodePtr> parents;
+            buildLevel(level, previousNodes, parents);
+            level.swap(parents);
         }
-        return true;
+        if (!level.empty()) {
+            snapshot->root = level.front();
+        }
+        return snapshot;
     }
 
-    
+    static void collectRecords(const NodePtr& node, std::vector<CurveRecordPtr>& out) {
+        out.insert(out.end(), node->records.begin(), node->records.end());
+        for (unsigned int i = 0; i < node->children.size(); i++) {
+            collectRecords(node->children[i], out);
+        }
+    }
+
+    //all records of the scene in order
+    void getRecords(std::vector<CurveRecordPtr>& out) const {
+        out.clear();
+        out.reserve(curveCount);
+        if (root) {
+            collectRecords(root, out);
+        }
+    }
+
+    //unchanged scenes end up with the very same tree
+    bool sameAs(const SceneSnapshot& other) const {
+        return root == other.root;
+    }
+
+    //writes the scene as text, or as a compact binary file (see writeCompactCurveRecord)
+    bool save(const char* path, bool compact) const {
+        std::string temporaryPath = std::string(path) + ".tmp";
+        FILE* file = fopen(temporaryPath.c_str(), compact ? "wb" : "w");
+        if (file == NULL) {
+            return false;
+        }
+        std::vector<CurveRecordPtr> records;
+        getRecords(records);
+        bool ok = !compact || fwrite(compactSceneTag, 1, sizeof(compactSceneTag), file) == sizeof(compactSceneTag);
+        for (unsigned int i = 0; i < records.size() && ok; i++) {
+            ok = compact ? writeCompactCurveRecord(file, *records[i]) : writeCurveRecord(file, *records[i]);
+        }
+        ok = (fclose(file) == 0) && ok;
+        //rename replaces the old file in one step, so a crash never leaves a half written autosave behind
+        return ok && rename(temporaryPath.c_str(), path) == 0;
+    }
 };
+typedef std::shared_ptr<const SceneSnapshot> SceneSnapshotPtr;
 
 /**
- BezierCurve: extends freeform and implements curve using Bezier interpolation
+ History: undo and redo stacks of scene snapshots. The back of undoStack is always the current state.
  */
-class BezierCurve : public Freeform
+class History {
+    std::vector<SceneSnapshotPtr> undoStack;
+    std::vector<SceneSnapshotPtr> redoStack;
 
-{
-    public:
-    BezierCurve() : Freeform(1.0) {}
+public:
+    static const unsigned int maxUndoSteps = 256;
 
-    static double bernstein(int i, int n, double t) {
-        //i is index of control point, n is one less than number of control points
-        if(n == 1) {
-            if(i == 0) return 1-t;
-            if(i == 1) return t;
-            return 0;
+    //records the current scene as a new version, unless nothing changed since the last one. returns true if a version was added
+    bool commit(const std::vector<Freeform*>& curves) {
+        const SceneSnapshot* previous = undoStack.empty() ? NULL : undoStack.back().get();
+        SceneSnapshotPtr snapshot = SceneSnapshot::capture(curves, previous);
+        if (previous != NULL && snapshot->sameAs(*previous)) {
+            return false;
+        }
+        undoStack.push_back(snapshot);
+        if (undoStack.size() > maxUndoSteps) {
+            undoStack.erase(undoStack.begin());
         }
-        if(i < 0 || i > n) return 0;
-        return (1 - t) * bernstein(i,   n-1, t)
-        +      t  * bernstein(i-1, n-1, t);
+        redoStack.clear();
+        return true;
     }
-    
-    float2 getPoint(float t) //calculates a point from the control points
-    {
-        float2 r(0.0, 0.0);
-        float weight;
-        // for every control point
-        for (float i = 0; i < controlPoints.size(); i++) {
-            // compute weight using the Bernstein formula
-            weight = bernstein(i, controlPoints.size()-1, t);
-            r += controlPoints.at(i)*weight;
-        }
-        // add control point to r, weighted
-        return r;
+
+    //returns the snapshot to restore, or NULL if there is nothing to undo
+    SceneSnapshotPtr undo() {
+        if (undoStack.size() < 2) {
+            return SceneSnapshotPtr();
+        }
+        redoStack.push_back(undoStack.back());
+        undoStack.pop_back();
+        return undoStack.back();
+    }
+
+    SceneSnapshotPtr redo() {
+        if (redoStack.empty()) {
+            return SceneSnapshotPtr();
+        }
+        undoStack.push_back(redoStack.back());
+        redoStack.pop_back();
+        return undoStack.back();
+    }
+
+    SceneSnapshotPtr current() {
+        return undoStack.empty() ? SceneSnapshotPtr() : undoStack.back();
     }
 };
-Freeform *selectedCurve;
+History history;
 
 /**
- LagrangeCurve: extends freeform and implements curve using Lagrange interpolation
+ Autosaver: writes the most recently published snapshot to disk on a background thread.
+ The GLUT thread hands snapshots over through a single atomic slot, so publishing never blocks or takes a lock.
+ stop() wakes the thread, lets it save what is still pending and joins it.
  */
-class LagrangeCurve : public Freeform
-{
-    std::vector<float> knots;
-public:
-    LagrangeCurve() : Freeform(2) {}
-    
-    void addControlPoint(float2 p)
-    {
-        controlPoints.push_back(p);
-        int vecSize = controlPoints.size();
-        knots.clear();
-        if (vecSize ==1) {
-            knots.push_back(0);
-            return;
+class Autosaver {
+    //owned by the slot: whoever exchanges a box out of it is responsible for deleting it
+    std::atomic<SceneSnapshotPtr*> pending;
+    std::atomic<bool> running;
+    std::string path;
+    int intervalSeconds;
+    bool compact;
+    std::thread thread;
+    //only used to sleep between saves and to be woken by stop
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    void savePending(SceneSnapshotPtr& lastSaved) {
+        SceneSnapshotPtr* box = pending.exchange(NULL);
+        if (box != NULL) {
+            if (*box != lastSaved && (*box)->save(path.c_str(), compact)) {
+                lastSaved = *box;
+            }
+            delete box;
         }
-        double knotIncrement = 1.0/ (vecSize -1);
-        double counter = 0;
-        for (int i = 0; i < vecSize; i++) {
-            knots[i] = counter;
-            counter += knotIncrement;
+    }
+
+    void run() {
+        SceneSnapshotPtr lastSaved;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running) {
+            wake.wait_for(lock, std::chrono::seconds(intervalSeconds), [this] { return !running; });
+            savePending(lastSaved);
         }
+        //whatever was published just before stop
+        savePending(lastSaved);
+    }
+
+public:
+    Autosaver() : pending(NULL), running(false), intervalSeconds(5), compact(false) {}
+
+    ~Autosaver() {
+        stop();
     }
-    
-    void eraseControlPoint(int point) {
-        controlPoints.erase(controlPoints.begin() + point);
-        int vecSize = controlPoints.size();
 
-        knots.clear();
-        if (vecSize ==1) {
-            knots.push_back(0);
+    void start(const char* savePath, int interval, bool compactFile) {
+        path = savePath;
+        intervalSeconds = interval;
+        compact = compactFile;
+        running = true;
+        thread = std::thread(&Autosaver::run, this);
+    }
+
+    void stop() {
+        if (!thread.joinable()) {
             return;
         }
-        double knotIncrement = 1.0/ (vecSize -1);
-        double counter = 0;
-        for (int i = 0; i < vecSize; i++) {
-            knots[i] = counter;
-            counter += knotIncrement;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
         }
+        wake.notify_all();
+        thread.join();
     }
-    
-    double lagrange(int i, int n, double t) {
-        //i is index of control point, n is one less than number of control points
-        //t0, t1, ...tn-1 are the knot values: must be chosen by modeler just like control points
-        //r0, r1...rn-1: control points sequence.
-        double numerator = 1;
-        double denominator = 1;
-        
-        for (int j = 0; j <= controlPoints.size()-1; j++)
-        {
-            
-            if (j != i) {
-                //subtract knot value at j
-                numerator *= (t - knots[j]);
-                denominator *= (knots[i] - knots[j]);
-            }
+
+    void publish(const SceneSnapshotPtr& snapshot) {
+        if (!running) {
+            return;
         }
-        double returnWeight = numerator/denominator;
-        return returnWeight;
+        SceneSnapshotPtr* previous = pending.exchange(new SceneSnapshotPtr(snapshot));
+        delete previous;
     }
+};
+Autosaver autosaver;
+const char* autosavePath = "curves.autosave";
+
+//glutMainLoop never returns, so the autosave thread is stopped when the program exits
+void stopAutosave() {
+    autosaver.stop();
+}
 
-    float2 getDerivative(float t) {
-        return float2(0.0,0.0);
+//replaces the live scene with snapshot. curves whose record is still current are kept, everything else is rebuilt from its record
+void restoreSnapshot(const SceneSnapshot& snapshot) {
+    std::unordered_map<const CurveRecord*, Freeform*> liveCurves;
+    for (unsigned int i = 0; i < curves.size(); i++) {
+        liveCurves[curves.at(i)->freeze().get()] = curves.at(i);
     }
-    
-    float2 getPoint(float t) //calculates a point from the control points
-    {
-        float2 r(0.0, 0.0);
-        double weight;
-        // for every control point
-        for (float i = 0; i < controlPoints.size(); i++) {
-            // compute weight using the Bernstein formula
-            weight = lagrange(i, controlPoints.size()-1, t);
-            r += controlPoints.at(i)*weight;
-        }
-        // add control point to r, weighted
-        return r;
+    curvesContainer.clearSelection();
+    std::vector<Freeform*> restored;
+    restored.reserve(snapshot.curveCount);
+    std::vector<CurveRecordPtr> records;
+    snapshot.getRecords(records);
+    for (unsigned int i = 0; i < records.size(); i++) {
+        std::unordered_map<const CurveRecord*, Freeform*>::iterator live = liveCurves.find(records[i].get());
+        if (live != liveCurves.end()) {
+            restored.push_back(live->second);
+            liveCurves.erase(live);
+        }
+        else {
+            restored.push_back(createCurve(records[i]));
+        }
     }
-};
+    if (selectedCurve != NULL) {
+        selectedCurve->setUnSelected();
+    }
+    //curves that are not part of the restored version are only referenced by their records now
+    for (std::unordered_map<const CurveRecord*, Freeform*>::iterator it = liveCurves.begin(); it != liveCurves.end(); ++it) {
+        delete it->second;
+    }
+    curves.swap(restored);
+    selectedCurve = NULL;
+    currSelectedCurve = -1;
+    globalCounter = curves.size() - 1;
+    movingAPoint = false;
+}
 
+//records the scene after an edit, and passes the new version on to the autosave thread
+void commitHistory() {
+    if (history.commit(curves)) {
+        autosaver.publish(history.current());
+    }
+}
 
-//this class manages all the objects. we store object pointers.
-class CurvesContainer
-{
-public:
+//tolerances in viewport units for simplifying polylines and fitting Bezier chains to them
+const float simplifyTolerance = 0.005f;
+const float fitTolerance = 0.01f;
+//imported polylines are always simplified; with this set they are also converted to Bezier chains
+bool fitBeziersOnImport = false;
+//files loaded after -import are treated as sketch or scan data instead of saved scenes
+bool importingFiles = false;
 
-    //registers an object in this countainer
-    void addCurve(Freeform* curve) {
-        curves.push_back(curve);
+//replaces the polyline at index with a chain of Bezier curves fitted to it. returns the number of curves in the chain, 0 if nothing changed
+int convertPolylineToBeziers(int index, float maxError) {
+    Freeform* polyline = curves.at(index);
+    if (polyline->getCurveType() != 0) {
+        return 0;
     }
-    //releases all the objects stored in the object container. we only need to do this with objects created with "new"
-    CurvesContainer() {
-        for(unsigned int i=0; i<curves.size(); i++)
-            delete curves.at(i);
+    std::vector<float2> points;
+    polyline->getControlPoints(points);
+    BezierFitter fitter(points, maxError);
+    std::vector<BezierCurve*> chain = fitter.fit();
+    if (chain.empty()) {
+        return 0;
     }
-    //draws all the objects in the container
-    void draw() {
-        for(unsigned int i=0; i<curves.size(); i++) {
-            curves.at(i)->draw();
-        }
+    for (unsigned int i = 0; i < chain.size(); i++) {
+        chain[i]->setCompactStorage(compactStorage);
     }
-    void drawControlPoints() {
-        for(unsigned int i=0; i<curves.size(); i++) {
-            curves.at(i)->drawControlPoints();
-        }
+    curvesContainer.deselect(polyline);
+    curves.erase(curves.begin() + index);
+    curves.insert(curves.begin() + index, chain.begin(), chain.end());
+    delete polyline;
+    globalCounter = curves.size() - 1;
+    return chain.size();
+}
+
+//prints how much memory the control points of the current version take, and the largest quantization error measured
+void printStorageStats() {
+    SceneSnapshotPtr snapshot = history.current();
+    size_t pointCount = 0, storageSize = 0;
+    float maxError = 0;
+    std::vector<CurveRecordPtr> records;
+    if (snapshot) {
+        snapshot->getRecords(records);
     }
-    int checkMouseCurves(float x, float y) {
-        for (unsigned int i = 0; i < curves.size(); i++ ) {
-            if (curves.at(i)->mouseOverCurve(x, y)) {
-                return i;
+    for (unsigned int i = 0; i < records.size(); i++) {
+        pointCount += records[i]->pointCount();
+        storageSize += records[i]->storageSize();
+        maxError = fmaxf(maxError, records[i]->compactPoints.measuredError());
+    }
+    printf("%lu control points in %lu bytes (%lu as floats), max quantization error %g (bound %g)\n",
+           (unsigned long)pointCount, (unsigned long)storageSize, (unsigned long)(pointCount * sizeof(float2)),
+           maxError, CompactPoints::maxErrorBound());
+}
+
+//loads a file written by SceneSnapshot::save, appending its curves to the scene. saved scenes and autosaves are loaded as they
+//are; with import set the polylines are cleaned up on the way in
+bool loadScene(const char* path, bool import) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char tag[sizeof(compactSceneTag)];
+    bool compactFile = fread(tag, 1, sizeof(tag), file) == sizeof(tag) && memcmp(tag, compactSceneTag, sizeof(tag)) == 0;
+    if (!compactFile) {
+        rewind(file);
+    }
+    std::shared_ptr<CurveRecord> record = std::make_shared<CurveRecord>();
+    std::vector<float2> points;
+    while (compactFile ? readCompactCurveRecord(file, *record) : readCurveRecord(file, *record)) {
+        //keep the record that the new curve shares in the storage mode the scene uses
+        if (record->isCompact() != compactStorage) {
+            record->getControlPoints(points);
+            record->setControlPoints(points, compactStorage);
+        }
+        Freeform* curve = createCurve(record);
+        record = std::make_shared<CurveRecord>();
+        if (curve != NULL && curve->getControlPointsSize() >= 2) {
+            curvesContainer.addCurve(curve);
+            //imported polylines are usually dense sketch or scan data
+            if (import && curve->getCurveType() == 0) {
+                static_cast<Polyline*>(curve)->simplify(simplifyTolerance);
+                if (fitBeziersOnImport) {
+                    convertPolylineToBeziers(curves.size() - 1, fitTolerance);
+                }
             }
         }
-        return -1;
+        else {
+            delete curve;
+        }
     }
-
-};
-CurvesContainer curvesContainer;
-int globalCounter = -1;
+    fclose(file);
+    globalCounter = curves.size() - 1;
+    return true;
+}
 
 /**
 onKeyboard: checks for keyboard presses. 
@@ -512,6 +766,62 @@ void onKeyboard(unsigned char key,int x, int y) {
                     addingPoints = true;
                 }
                 break;
+
+            //rubber band selection of several curves
+            case 'r':
+                rubberBanding = true;
+                break;
+
+            //dragging moves, rotates or scales the whole multi-selection
+            case 't':
+                translatingSelection = true;
+                break;
+
+            case 'o':
+                rotatingSelection = true;
+                break;
+
+            case 's':
+                scalingSelection = true;
+                break;
+
+            //undo and redo restore the previous or next version of the scene. restoring clears selectedCurve, so they wait
+            //until no key that edits the selected curve is held
+            case 'z':
+                if (!drawing && !movingAPoint && !addingPoints && !deletingPoints) {
+                    SceneSnapshotPtr snapshot = history.undo();
+                    if (snapshot) {
+                        restoreSnapshot(*snapshot);
+                        autosaver.publish(snapshot);
+                    }
+                }
+                break;
+
+            case 'y':
+                if (!drawing && !movingAPoint && !addingPoints && !deletingPoints) {
+                    SceneSnapshotPtr snapshot = history.redo();
+                    if (snapshot) {
+                        restoreSnapshot(*snapshot);
+                        autosaver.publish(snapshot);
+                    }
+                }
+                break;
+
+            //simplify the selected polyline
+            case 'f':
+                if (selectedCurve != NULL && !drawing && !movingAPoint && !draggingSelection && selectedCurve->getCurveType() == 0) {
+                    static_cast<Polyline*>(selectedCurve)->simplify(simplifyTolerance);
+                }
+                break;
+
+            //convert the selected polyline to a chain of Bezier curves
+            case 'c':
+                if (selectedCurve != NULL && !drawing && !movingAPoint && !draggingSelection && currSelectedCurve != -1 && selectedCurve->getCurveType() == 0) {
+                    if (convertPolylineToBeziers(currSelectedCurve, fitTolerance) > 0) {
+                        selectedCurve = curves.at(currSelectedCurve);
+                    }
+                }
+                break;
         }
     }
     glutPostRedisplay();
@@ -526,17 +836,25 @@ void onKeyboardUp(unsigned char key, int x, int y) {
     drawing = false;
     addingPoints = false;
     deletingPoints = false;
+    rubberBanding = false;
+    translatingSelection = false;
+    rotatingSelection = false;
+    scalingSelection = false;
+    draggingSelection = false;
+    curvesContainer.endSelectionDrag();
     if (curves.size() > 0) {
         Freeform *checkCtrlPtNum = curves.at(globalCounter);
         int controlPointsSize = checkCtrlPtNum->getControlPointsSize();
         if (controlPointsSize < 2) {
             //delete that curve
+            curvesContainer.deselect(checkCtrlPtNum);
             curves.erase(curves.begin() + globalCounter);
             globalCounter --;
             currSelectedCurve = -1;
             selectedCurve = NULL;
         }
     }
+    commitHistory();
     glutPostRedisplay();
 }
 
@@ -551,6 +869,29 @@ void onMouse(int button, int state, int x, int y) {
     //check state --> left, right up down
     Freeform *curvePointer;
     
+    //rubber band selection and selection transforms take over the mouse while their key is held
+    if (rubberBanding || translatingSelection || rotatingSelection || scalingSelection) {
+        float2 mousePosition(x * 2.0 / viewportRect[2] - 1.0, -y * 2.0 / viewportRect[3] + 1.0);
+        if (state == GLUT_DOWN) {
+            dragStart = mousePosition;
+            lastMousePosition = mousePosition;
+            draggingSelection = true;
+            curvesContainer.startSelectionDrag();
+        }
+        if (state == GLUT_UP && draggingSelection) {
+            if (rubberBanding) {
+                curvesContainer.selectInRectangle(dragStart, mousePosition);
+            }
+            else {
+                commitHistory();
+            }
+            draggingSelection = false;
+            curvesContainer.endSelectionDrag();
+        }
+        glutPostRedisplay();
+        return;
+    }
+
     //Case: mouse is pressed
     if (state == GLUT_DOWN) {
         
@@ -574,6 +915,7 @@ void onMouse(int button, int state, int x, int y) {
                 selectedCurve->eraseControlPoint(pointToDelete);
             }
             if (selectedCurve->getControlPointsSize() <2) {
+                curvesContainer.deselect(selectedCurve);
                 curves.erase(curves.begin() + currSelectedCurve);
                 currSelectedCurve = -1;
                 globalCounter --;
@@ -624,6 +966,7 @@ void onMouse(int button, int state, int x, int y) {
             float2 xAndY = float2(x * 2.0 / viewportRect[2] - 1.0, -y * 2.0 / viewportRect[3] + 1.0);
             selectedCurve->setNewControlPointValue(controlPointVal, xAndY);
             movingAPoint = false;
+            commitHistory();
         }
         
     }
@@ -640,6 +983,27 @@ void onMouseMotionFunc(int x, int y) {
         float2 xAndY = float2(x * 2.0 / viewportRect[2] - 1.0, -y * 2.0 / viewportRect[3] + 1.0);
         selectedCurve->setNewControlPointValue(controlPointVal, xAndY);
     }
+    if (draggingSelection) {
+        float2 mousePosition(x * 2.0 / viewportRect[2] - 1.0, -y * 2.0 / viewportRect[3] + 1.0);
+        if (translatingSelection) {
+            curvesContainer.transformSelection(AffineTransform::translation(mousePosition - lastMousePosition));
+        }
+        else if (rotatingSelection || scalingSelection) {
+            float2 center = curvesContainer.getSelectionCenter();
+            float2 from = lastMousePosition - center;
+            float2 to = mousePosition - center;
+            if (from.norm2() > 1e-8 && to.norm2() > 1e-8) {
+                if (rotatingSelection) {
+                    float angle = atan2f(to.y, to.x) - atan2f(from.y, from.x);
+                    curvesContainer.transformSelection(AffineTransform::rotation(angle, center));
+                }
+                else {
+                    curvesContainer.transformSelection(AffineTransform::scaling(to.norm() / from.norm(), center));
+                }
+            }
+        }
+        lastMousePosition = mousePosition;
+    }
     glutPostRedisplay();
 }
 
@@ -654,6 +1018,17 @@ void onDisplay( ) {
     curvesContainer.draw();
     glColor3d(1.0, 1.0, 1.0);
     curvesContainer.drawControlPoints();
+
+    //outline of the rubber band while it is being dragged
+    if (rubberBanding && draggingSelection) {
+        glLineWidth(1);
+        glBegin(GL_LINE_LOOP);
+        glVertex2d(dragStart.x, dragStart.y);
+        glVertex2d(lastMousePosition.x, dragStart.y);
+        glVertex2d(lastMousePosition.x, lastMousePosition.y);
+        glVertex2d(dragStart.x, lastMousePosition.y);
+        glEnd();
+    }
     
     glutSwapBuffers();                     		// Swap buffers for double buffering
     
@@ -668,6 +1043,30 @@ int main(int argc, char *argv[]) {
     glutInitWindowPosition(100, 100);            // Initial location of the MsWindows window
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);    // Image = 8 bit R,G,B + double buffer + depth buffer
     glutCreateWindow("Curves Editor");        	// Window is born
+
+    //a scene file (e.g. a previous autosave) can be passed as argument. options apply to the files after them:
+    //-import simplifies the polylines of the files, -fit also converts them to Bezier chains,
+    //-compact stores control points quantized and autosaves in the compact format
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-import") == 0) {
+            importingFiles = true;
+        }
+        else if (strcmp(argv[i], "-fit") == 0) {
+            fitBeziersOnImport = true;
+        }
+        else if (strcmp(argv[i], "-compact") == 0) {
+            compactStorage = true;
+        }
+        else if (!loadScene(argv[i], importingFiles)) {
+            fprintf(stderr, "Could not load %s\n", argv[i]);
+        }
+    }
+    commitHistory();
+    if (compactStorage) {
+        printStorageStats();
+    }
+    autosaver.start(autosavePath, 5, compactStorage);
+    atexit(stopAutosave);
     
     glutKeyboardFunc(onKeyboard);
     glutKeyboardUpFunc(onKeyboardUp);
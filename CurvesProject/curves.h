@@ -5,10 +5,1814 @@
 //  Created by Dani Gnibus on 9/28/15.
 //  Copyright (c) 2015 Dani Gnibus. All rights reserved.
 //
+//  Curve classes shared by the editor and the headless tessellator.
+//  Define CURVES_HEADLESS before including to leave out everything that draws with OpenGL.
+//
 
 #ifndef __CurvesProject__curves__
 #define __CurvesProject__curves__
 
 #include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include "float2.h"
+
+#ifndef CURVES_HEADLESS
+#include <OpenGL/gl.h>
+#endif
+
+/**
+ AffineTransform: 2x3 matrix that maps a point (x, y) to (a*x + b*y + tx, c*x + d*y + ty). Used for bulk edits of the selection.
+ */
+class AffineTransform {
+public:
+    float a, b, c, d, tx, ty;
+
+    AffineTransform(float a, float b, float c, float d, float tx, float ty) : a(a), b(b), c(c), d(d), tx(tx), ty(ty) {}
+
+    static AffineTransform translation(float2 offset) {
+        return AffineTransform(1, 0, 0, 1, offset.x, offset.y);
+    }
+
+    //rotation by angle (radians, counterclockwise) around pivot
+    static AffineTransform rotation(float angle, float2 pivot) {
+        float cosine = cosf(angle);
+        float sine = sinf(angle);
+        return AffineTransform(cosine, -sine, sine, cosine,
+                               pivot.x - cosine * pivot.x + sine * pivot.y,
+                               pivot.y - sine * pivot.x - cosine * pivot.y);
+    }
+
+    //uniform scaling by factor around pivot
+    static AffineTransform scaling(float factor, float2 pivot) {
+        return AffineTransform(factor, 0, 0, factor, pivot.x - factor * pivot.x, pivot.y - factor * pivot.y);
+    }
+
+    float2 apply(float2 p) const {
+        return float2(a * p.x + b * p.y + tx, c * p.x + d * p.y + ty);
+    }
+
+    //this transform followed by next
+    AffineTransform then(const AffineTransform& next) const {
+        return AffineTransform(next.a * a + next.b * c, next.a * b + next.b * d,
+                               next.c * a + next.d * c, next.c * b + next.d * d,
+                               next.a * tx + next.b * ty + next.tx, next.c * tx + next.d * ty + next.ty);
+    }
+
+    bool isTranslation() const {
+        return a == 1 && b == 0 && c == 0 && d == 1;
+    }
+
+    //true for rotations and translations, which keep lengths and angles
+    bool isRigid() const {
+        return fabsf(a * a + c * c - 1) < 1e-5f && fabsf(b * b + d * d - 1) < 1e-5f && fabsf(a * b + c * d) < 1e-5f && a * d - b * c > 0;
+    }
+
+    //directions such as derivatives are not translated
+    float2 applyToVector(float2 v) const {
+        return float2(a * v.x + b * v.y, c * v.x + d * v.y);
+    }
+
+    //transforms count points stored as interleaved x, y floats in place.
+    //kept as a flat loop over plain floats with no branches so the compiler vectorizes it
+    void apply(float* xy, size_t count) const {
+        const float a = this->a, b = this->b, c = this->c, d = this->d, tx = this->tx, ty = this->ty;
+        for (size_t i = 0; i < count; i++) {
+            float x = xy[2 * i];
+            float y = xy[2 * i + 1];
+            xy[2 * i] = a * x + b * y + tx;
+            xy[2 * i + 1] = c * x + d * y + ty;
+        }
+    }
+
+    void apply(std::vector<float2>& points) const {
+        static_assert(sizeof(float2) == 2 * sizeof(float), "float2 must be two packed floats");
+        if (!points.empty()) {
+            apply(&points[0].x, points.size());
+        }
+    }
+};
+
+/**
+ CompactPoints: control points quantized to 16 bit fixed point over the [-1,1] viewport square. In memory every point takes
+ two 16 bit values, so single points can be read and changed in place; files store them either like that or as zigzag
+ varint deltas between neighbouring points. Quantization moves each coordinate by at most half a step, maxErrorBound();
+ the largest error actually measured is kept in measuredError() and saved along with the points.
+ */
+class CompactPoints {
+    //x and y of every point, interleaved
+    std::vector<int16_t> coordinates;
+    float error = 0;
+
+    static void appendVarint(uint32_t value, std::vector<uint8_t>& out) {
+        while (value >= 0x80) {
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+    }
+
+    //reads a varint of at most 5 bytes, all that 32 bits need. returns false if it runs past end or doesn't fit 32 bits
+    static bool readVarint(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (p == end) {
+                return false;
+            }
+            uint8_t byte = *p++;
+            //the fifth byte only has room for the top 4 bits
+            if (shift == 28 && byte > 0x0f) {
+                return false;
+            }
+            value |= (uint32_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //maps small negative and positive deltas to small unsigned values
+    static uint32_t zigzag(int32_t value) {
+        return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    }
+
+    static int32_t unzigzag(uint32_t value) {
+        return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    }
+
+    //quantizes one coordinate, keeping track of the error
+    int16_t store(float value) {
+        int quantized = quantize(value);
+        error = fmaxf(error, fabsf(dequantize(quantized) - value));
+        return (int16_t)quantized;
+    }
+
+public:
+    enum { Fixed16 = 1, DeltaVarint = 2 };
+    static const int fixedScale = 32767;
+
+    //half a quantization step, plus one float ulp at 1 for rounding in quantize and dequantize
+    static float maxErrorBound() {
+        return 0.5f / fixedScale + 1.2e-7f;
+    }
+
+    static int quantize(float value) {
+        return (int)lroundf(value * fixedScale);
+    }
+
+    static float dequantize(int value) {
+        return value / (float)fixedScale;
+    }
+
+    //true if the point lies in the viewport square
+    static bool fits(float2 point) {
+        return fabsf(point.x) <= 1.0f && fabsf(point.y) <= 1.0f;
+    }
+
+    static bool fits(const std::vector<float2>& points) {
+        for (unsigned int i = 0; i < points.size(); i++) {
+            if (!fits(points[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //points must pass fits(), here and in every method that takes new points
+    void encode(const std::vector<float2>& points) {
+        coordinates.resize(2 * points.size());
+        for (unsigned int i = 0; i < points.size(); i++) {
+            coordinates[2 * i] = store(points[i].x);
+            coordinates[2 * i + 1] = store(points[i].y);
+        }
+    }
+
+    void decode(std::vector<float2>& out) const {
+        out.resize(size());
+        for (unsigned int i = 0; i < out.size(); i++) {
+            out[i] = float2(dequantize(coordinates[2 * i]), dequantize(coordinates[2 * i + 1]));
+        }
+    }
+
+    //at, set and erase check index like std::vector::at does
+    float2 at(size_t index) const {
+        if (index >= size()) {
+            throw std::out_of_range("compact point index");
+        }
+        return float2(dequantize(coordinates[2 * index]), dequantize(coordinates[2 * index + 1]));
+    }
+
+    void set(size_t index, float2 point) {
+        if (index >= size()) {
+            throw std::out_of_range("compact point index");
+        }
+        coordinates[2 * index] = store(point.x);
+        coordinates[2 * index + 1] = store(point.y);
+    }
+
+    void push_back(float2 point) {
+        coordinates.push_back(store(point.x));
+        coordinates.push_back(store(point.y));
+    }
+
+    void erase(size_t index) {
+        if (index >= size()) {
+            throw std::out_of_range("compact point index");
+        }
+        coordinates.erase(coordinates.begin() + 2 * index, coordinates.begin() + 2 * index + 2);
+    }
+
+    //sets the points to source's points with transform applied, which may be this object's own. the points stay quantized
+    //throughout: each one is transformed in fixed point, range checked and rounded into a scratch buffer in a single pass
+    //without branches, and the buffer is only copied over the points if all of them stayed in the viewport square.
+    //returns false and changes nothing otherwise, including for transforms too large for the fixed point
+    bool transform(const CompactPoints& source, const AffineTransform& transform) {
+        if (transform.isTranslation()) {
+            return translate(source, transform.tx, transform.ty);
+        }
+        //coefficients get 30 fractional bits. up to 256 every product with a quantized coordinate, and their sums, stay
+        //below 2^55, so adding the bias keeps them positive and shifts of unsigned values round them towards minus infinity
+        const int fractionBits = 30;
+        const double one = (double)(1 << fractionBits), largest = 256;
+        const double matrix[6] = { transform.a, transform.b, transform.c, transform.d,
+                                   transform.tx * (double)fixedScale, transform.ty * (double)fixedScale };
+        int64_t fixed[6];
+        for (int k = 0; k < 6; k++) {
+            double limit = k < 4 ? largest : largest * fixedScale;
+            if (!(fabs(matrix[k]) <= limit)) {
+                return false;
+            }
+            fixed[k] = llround(matrix[k] * one);
+        }
+        const uint64_t half = (uint64_t)1 << (fractionBits - 1), mask = ((uint64_t)1 << fractionBits) - 1;
+        const uint64_t bias = (uint64_t)1 << 56, biasSteps = bias >> fractionBits;
+        //large selections are transformed on several threads, so every thread has its own buffer
+        static thread_local std::vector<int16_t> scratch;
+        size_t count = source.coordinates.size();
+        scratch.resize(count);
+        const int16_t* in = source.coordinates.data();
+        int16_t* out = scratch.data();
+        int64_t outside = 0;
+        //largest distances between transformed coordinates and their rounded values, in 2^-30 quantization steps. x and y
+        //are kept apart so the two don't wait for each other
+        uint64_t largestRoundingX = 0, largestRoundingY = 0;
+        for (size_t i = 0; i < count; i += 2) {
+            int64_t quantizedX = in[i], quantizedY = in[i + 1];
+            uint64_t x = (uint64_t)(fixed[0] * quantizedX + fixed[1] * quantizedY + fixed[4]) + bias + half;
+            uint64_t y = (uint64_t)(fixed[2] * quantizedX + fixed[3] * quantizedY + fixed[5]) + bias + half;
+            int64_t roundedX = (int64_t)((x >> fractionBits) - biasSteps), roundedY = (int64_t)((y >> fractionBits) - biasSteps);
+            //negative exactly when a rounded coordinate is outside [-fixedScale, fixedScale]
+            outside |= (roundedX + fixedScale) | (fixedScale - roundedX) | (roundedY + fixedScale) | (fixedScale - roundedY);
+            out[i] = (int16_t)roundedX;
+            out[i + 1] = (int16_t)roundedY;
+            uint64_t roundingX = x & mask, roundingY = y & mask;
+            roundingX = roundingX < half ? half - roundingX : roundingX - half;
+            roundingY = roundingY < half ? half - roundingY : roundingY - half;
+            largestRoundingX = roundingX > largestRoundingX ? roundingX : largestRoundingX;
+            largestRoundingY = roundingY > largestRoundingY ? roundingY : largestRoundingY;
+        }
+        if (outside < 0) {
+            return false;
+        }
+        coordinates.assign(scratch.begin(), scratch.end());
+        uint64_t largestRounding = largestRoundingX > largestRoundingY ? largestRoundingX : largestRoundingY;
+        error = fmaxf(fmaxf(error, source.error), (float)(largestRounding / one / fixedScale));
+        return true;
+    }
+
+    //translations move every point by the same number of quantization steps, up to rounding, so they need no floats:
+    //rounding the translation once gives the points that rounding every translated point would
+    bool translate(const CompactPoints& source, float offsetX, float offsetY) {
+        const float scale = fixedScale;
+        size_t count = source.coordinates.size();
+        float stepsX = offsetX * scale, stepsY = offsetY * scale;
+        //further than across the whole square, every point leaves it
+        if (!(fabsf(stepsX) <= 2 * scale) || !(fabsf(stepsY) <= 2 * scale)) {
+            return count == 0;
+        }
+        int shiftX = quantize(offsetX), shiftY = quantize(offsetY);
+        const int16_t* in = source.coordinates.data();
+        int outside = 0;
+        for (size_t i = 0; i < count; i += 2) {
+            int x = in[i] + shiftX, y = in[i + 1] + shiftY;
+            outside |= (x < -fixedScale) | (x > fixedScale) | (y < -fixedScale) | (y > fixedScale);
+        }
+        if (outside) {
+            return false;
+        }
+        coordinates.resize(count);
+        int16_t* out = coordinates.data();
+        for (size_t i = 0; i < count; i += 2) {
+            out[i] = (int16_t)(in[i] + shiftX);
+            out[i + 1] = (int16_t)(in[i + 1] + shiftY);
+        }
+        float rounding = fmaxf(fabsf(shiftX - stepsX), fabsf(shiftY - stepsY)) / scale;
+        error = fmaxf(fmaxf(error, source.error), count > 0 ? rounding : 0);
+        return true;
+    }
+
+    size_t size() const {
+        return coordinates.size() / 2;
+    }
+
+    size_t byteSize() const {
+        return coordinates.size() * sizeof(int16_t);
+    }
+
+    float measuredError() const {
+        return error;
+    }
+
+    //binary form used by compact scene files: encoding, point count, byte count, measured error, then the encoded bytes
+    bool write(FILE* file, int encoding) const {
+        std::vector<uint8_t> bytes;
+        int previousX = 0, previousY = 0;
+        for (size_t i = 0; i < coordinates.size(); i += 2) {
+            if (encoding == Fixed16) {
+                for (int j = 0; j < 2; j++) {
+                    uint16_t value = (uint16_t)coordinates[i + j];
+                    bytes.push_back((uint8_t)(value & 0xff));
+                    bytes.push_back((uint8_t)(value >> 8));
+                }
+            }
+            else {
+                appendVarint(zigzag(coordinates[i] - previousX), bytes);
+                appendVarint(zigzag(coordinates[i + 1] - previousY), bytes);
+                previousX = coordinates[i];
+                previousY = coordinates[i + 1];
+            }
+        }
+        uint32_t errorBits;
+        memcpy(&errorBits, &error, 4);
+        return fputc(encoding, file) != EOF && writeUint32(file, size()) && writeUint32(file, bytes.size()) && writeUint32(file, errorBits)
+            && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+
+    //reads the form written by write
+    bool read(FILE* file) {
+        int encoding = fgetc(file);
+        uint32_t count, byteCount, errorBits;
+        if ((encoding != Fixed16 && encoding != DeltaVarint) || !readUint32(file, count) || !readUint32(file, byteCount) || !readUint32(file, errorBits)) {
+            return false;
+        }
+        //a fixed point needs exactly four bytes and a delta encoded point at most six
+        if ((encoding == Fixed16 && byteCount != count * 4ull) || (encoding == DeltaVarint && (byteCount < count * 2ull || byteCount > count * 6ull))) {
+            return false;
+        }
+        //the counts come from the file, so the bytes are read in pieces instead of trusting byteCount with one allocation
+        std::vector<uint8_t> bytes;
+        while (bytes.size() < byteCount) {
+            size_t used = bytes.size();
+            size_t piece = std::min<size_t>(byteCount - used, 1 << 16);
+            bytes.resize(used + piece);
+            if (fread(&bytes[used], 1, piece, file) != piece) {
+                return false;
+            }
+        }
+        //decoded into a separate vector, so a damaged record leaves the points as they were
+        std::vector<int16_t> decoded(2 * (size_t)count);
+        const uint8_t* p = bytes.data();
+        const uint8_t* end = p + bytes.size();
+        int64_t x = 0, y = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (encoding == Fixed16) {
+                x = (int16_t)(uint16_t)(p[0] | (p[1] << 8));
+                y = (int16_t)(uint16_t)(p[2] | (p[3] << 8));
+                p += 4;
+            }
+            else {
+                uint32_t deltaX, deltaY;
+                if (!readVarint(p, end, deltaX) || !readVarint(p, end, deltaY)) {
+                    return false;
+                }
+                x += unzigzag(deltaX);
+                y += unzigzag(deltaY);
+                if (x < INT16_MIN || x > INT16_MAX || y < INT16_MIN || y > INT16_MAX) {
+                    return false;
+                }
+            }
+            decoded[2 * i] = (int16_t)x;
+            decoded[2 * i + 1] = (int16_t)y;
+        }
+        //every byte must belong to a point
+        if (p != end) {
+            return false;
+        }
+        coordinates.swap(decoded);
+        memcpy(&error, &errorBits, 4);
+        return true;
+    }
+
+    static bool writeUint32(FILE* file, uint32_t value) {
+        uint8_t little[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+        return fwrite(little, 1, 4, file) == 4;
+    }
+
+    static bool readUint32(FILE* file, uint32_t& value) {
+        uint8_t little[4];
+        if (fread(little, 1, 4, file) != 4) {
+            return false;
+        }
+        value = little[0] | (little[1] << 8) | (little[2] << 16) | ((uint32_t)little[3] << 24);
+        return true;
+    }
+};
+
+/**
+ CurveRecord: a curve's type and control points. A live curve keeps its points in its record and edits them in place
+ until the record is shared; from then on the record is never modified, so scene snapshots and the autosave thread can
+ share records freely. Compact records keep their points as CompactPoints, until a point leaves the viewport square.
+ */
+struct CurveRecord {
+    int curveType;
+    //plain control points, empty when the record is compact
+    std::vector<float2> controlPoints;
+    CompactPoints compactPoints;
+    bool compact = false;
+
+    CurveRecord(int curveType = 0) : curveType(curveType) {}
+
+    bool isCompact() const {
+        return compact;
+    }
+
+    size_t pointCount() const {
+        return compact ? compactPoints.size() : controlPoints.size();
+    }
+
+    float2 point(size_t index) const {
+        return compact ? compactPoints.at(index) : controlPoints[index];
+    }
+
+    void getControlPoints(std::vector<float2>& out) const {
+        if (compact) {
+            compactPoints.decode(out);
+        }
+        else {
+            out = controlPoints;
+        }
+    }
+
+    //stores points compactly if asked to and they lie in the viewport square, as plain floats otherwise
+    void setControlPoints(const std::vector<float2>& points, bool useCompact) {
+        controlPoints.clear();
+        compactPoints = CompactPoints();
+        compact = useCompact && CompactPoints::fits(points);
+        if (compact) {
+            compactPoints.encode(points);
+        }
+        else {
+            controlPoints = points;
+        }
+    }
+
+    //switches to plain floats, for points that don't fit the viewport square
+    void expand() {
+        std::vector<float2> points;
+        compactPoints.decode(points);
+        setControlPoints(points, false);
+    }
+
+    void setPoint(size_t index, float2 point) {
+        if (compact && !CompactPoints::fits(point)) {
+            expand();
+        }
+        if (compact) {
+            compactPoints.set(index, point);
+        }
+        else {
+            controlPoints.at(index) = point;
+        }
+    }
+
+    void addPoint(float2 point) {
+        if (compact && !CompactPoints::fits(point)) {
+            expand();
+        }
+        if (compact) {
+            compactPoints.push_back(point);
+        }
+        else {
+            controlPoints.push_back(point);
+        }
+    }
+
+    void erasePoint(size_t index) {
+        if (index >= pointCount()) {
+            throw std::out_of_range("control point index");
+        }
+        if (compact) {
+            compactPoints.erase(index);
+        }
+        else {
+            controlPoints.erase(controlPoints.begin() + index);
+        }
+    }
+
+    //sets the points to origin's points with transform applied; origin may be this record. compact points that leave the
+    //viewport square are kept as floats, and become compact again once a later transform of origin brings them back
+    void transform(const CurveRecord& origin, const AffineTransform& transform) {
+        if (origin.compact && compactPoints.transform(origin.compactPoints, transform)) {
+            compact = true;
+            controlPoints.clear();
+            return;
+        }
+        if (origin.compact) {
+            origin.compactPoints.decode(controlPoints);
+        }
+        else if (&origin != this) {
+            controlPoints = origin.controlPoints;
+        }
+        compactPoints = CompactPoints();
+        compact = false;
+        transform.apply(controlPoints);
+    }
+
+    //bytes used by the control points
+    size_t storageSize() const {
+        return compact ? compactPoints.byteSize() : controlPoints.size() * sizeof(float2);
+    }
+};
+typedef std::shared_ptr<const CurveRecord> CurveRecordPtr;
+
+/**
+ buildStrokeStrip: turns a sampled curve into a triangle strip width pixels wide, appended to out as alternating left and
+ right vertices in viewport coordinates. Where tangents holds the curve's derivative at a sample, the strip is offset along
+ its normal. Elsewhere (polylines, cusps, the ends) offsets come from the neighbouring segments: corners get a miter join,
+ or a bevel join when the miter would be longer than miterLimit half widths. pixelsPerUnit converts viewport units to
+ pixels, so the width is the same in x and y for any window shape.
+ */
+inline void buildStrokeStrip(const std::vector<float2>& points, const std::vector<float2>& tangents, float width, float2 pixelsPerUnit, std::vector<float2>& out) {
+    const float miterLimit = 2.0f;
+    float halfWidth = width / 2;
+    float2 unitsPerPixel(1 / pixelsPerUnit.x, 1 / pixelsPerUnit.y);
+
+    //work in pixels, dropping repeated points which have no direction
+    std::vector<float2> p;
+    std::vector<float2> tangent;
+    for (unsigned int i = 0; i < points.size(); i++) {
+        float2 q = points[i] * pixelsPerUnit;
+        if (p.empty() || (q - p.back()).norm2() > 1e-6f) {
+            p.push_back(q);
+            tangent.push_back(i < tangents.size() ? tangents[i] * pixelsPerUnit : float2());
+        }
+    }
+    int n = p.size();
+    if (n < 2) {
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        float2 before = i > 0 ? p[i] - p[i - 1] : float2();
+        float2 after = i + 1 < n ? p[i + 1] - p[i] : float2();
+        float lengthBefore = before.norm();
+        float lengthAfter = after.norm();
+        float2 offset;
+        if (tangent[i].norm2() > 1e-12f) {
+            float2 direction = tangent[i].normalize();
+            offset = float2(-direction.y, direction.x) * halfWidth;
+        }
+        else if (i == 0 || i == n - 1) {
+            float2 direction = i == 0 ? after * (1 / lengthAfter) : before * (1 / lengthBefore);
+            offset = float2(-direction.y, direction.x) * halfWidth;
+        }
+        else {
+            float2 directionBefore = before * (1 / lengthBefore);
+            float2 directionAfter = after * (1 / lengthAfter);
+            float2 normalBefore(-directionBefore.y, directionBefore.x);
+            float2 normalAfter(-directionAfter.y, directionAfter.x);
+            float2 miter = normalBefore + normalAfter;
+            float miterLength = 0;
+            if (miter.norm2() > 1e-12f) {
+                miter.normalize();
+                miterLength = halfWidth / miter.dot(normalAfter);
+            }
+            if (miterLength > 0 && miterLength <= miterLimit * halfWidth) {
+                offset = miter * miterLength;
+            }
+            else {
+                //bevel: the outer side of the corner gets both segment offsets, the inner side keeps the miter point,
+                //but no further out than the shorter segment so it can't cross the rest of the strip
+                float innerLength = miterLength > 0 ? fminf(miterLength, fminf(lengthBefore, lengthAfter)) : 0;
+                bool leftTurn = directionBefore.x * directionAfter.y - directionBefore.y * directionAfter.x > 0;
+                if (leftTurn) {
+                    float2 inner = p[i] + miter * innerLength;
+                    out.push_back(inner * unitsPerPixel);
+                    out.push_back((p[i] - normalBefore * halfWidth) * unitsPerPixel);
+                    out.push_back(inner * unitsPerPixel);
+                    out.push_back((p[i] - normalAfter * halfWidth) * unitsPerPixel);
+                }
+                else {
+                    float2 inner = p[i] - miter * innerLength;
+                    out.push_back((p[i] + normalBefore * halfWidth) * unitsPerPixel);
+                    out.push_back(inner * unitsPerPixel);
+                    out.push_back((p[i] + normalAfter * halfWidth) * unitsPerPixel);
+                    out.push_back(inner * unitsPerPixel);
+                }
+                continue;
+            }
+        }
+        out.push_back((p[i] + offset) * unitsPerPixel);
+        out.push_back((p[i] - offset) * unitsPerPixel);
+    }
+}
+
+/**
+Curve class: Defines a virtual curve that the curves in this project inherit from
+ */
+class Curve {
+    
+public:
+    //draw each curve in its own unique color
+    int curveType;
+    
+    Curve(int curveType) : curveType(curveType) {}
+    virtual ~Curve() {}
+//    double color1 = ((double) rand() / (RAND_MAX));
+//    double color2 = ((double) rand() / (RAND_MAX));
+//    double color3 = ((double) rand() / (RAND_MAX));
+    double color1, color2, color3;
+    bool selected = false;
+    //true if curve is part of the rubber band multi-selection
+    bool inSelection = false;
+
+protected:
+    //cached tessellation of the curve with the derivatives at its samples (empty for polylines), and its bounding box.
+    //both are rebuilt lazily after invalidate()
+    std::vector<float2> samples;
+    std::vector<float2> sampleTangents;
+    float2 boundsMin, boundsMax;
+    bool samplesValid = false;
+    bool boundsValid = false;
+
+    //triangle strip for drawing the samples, valid for the width and pixel scale it was built with
+    std::vector<float2> stroke;
+    float strokeWidth = 0;
+    float2 strokePixelsPerUnit;
+    bool strokeValid = false;
+    //changes whenever the stroke does, so batches built from it know when to copy it again
+    unsigned int strokeVersion = 0;
+
+    //versions are unique across all curves, so a new curve allocated where a deleted one was never matches its version.
+    //large selections are transformed on several threads, so the counter is atomic
+    static unsigned int newStrokeVersion() {
+        static std::atomic<unsigned int> lastVersion(0);
+        return lastVersion.fetch_add(1) + 1;
+    }
+
+    //arc length table: arcLengths[k] is the length of the curve from t = 0 to the end of span k.
+    //spans split the parameter range evenly, except for polylines where each segment is a span.
+    //speedFits holds 5 coefficients per span, see fitSpan
+    std::vector<float> arcLengths;
+    std::vector<float> speedFits;
+    bool arcLengthsValid = false;
+
+    float speedAt(float t) {
+        return getDerivative(t).norm();
+    }
+
+    //measures the speed at the 5 Gauss-Legendre nodes of [t0, t1] and fits it with the polynomial
+    //fit[0] + fit[1] u + ... + fit[4] u^4 through them, over u in [-1,1] and scaled by half the span width, so that it
+    //integrates to length. returns the length of the span, which is the Gauss-Legendre quadrature of the speed.
+    //the nodes are symmetric, so the even and odd parts of the polynomial are fitted separately
+    float fitSpan(float t0, float t1, float fit[5]) {
+        static const float a = 0.5384693101f, b = 0.9061798459f;
+        float half = (t1 - t0) / 2;
+        float middle = (t0 + t1) / 2;
+        float center = speedAt(middle) * half;
+        float innerPlus = speedAt(middle + half * a) * half, innerMinus = speedAt(middle - half * a) * half;
+        float outerPlus = speedAt(middle + half * b) * half, outerMinus = speedAt(middle - half * b) * half;
+        float evenA = (innerPlus + innerMinus) / 2 - center, evenB = (outerPlus + outerMinus) / 2 - center;
+        float oddA = (innerPlus - innerMinus) / (2 * a), oddB = (outerPlus - outerMinus) / (2 * b);
+        float a2 = a * a, b2 = b * b;
+        fit[0] = center;
+        fit[2] = (evenA * b2 * b2 - evenB * a2 * a2) / (a2 * b2 * (b2 - a2));
+        fit[4] = (evenB * a2 - evenA * b2) / (a2 * b2 * (b2 - a2));
+        fit[3] = (oddB - oddA) / (b2 - a2);
+        fit[1] = oddA - fit[3] * a2;
+        return 2 * (fit[0] + fit[2] / 3 + fit[4] / 5);
+    }
+
+    //length covered by a fitted span from its start to u, given the coefficients of the antiderivative of its fit
+    static float fitLength(const float integral[5], float start, float u) {
+        return u * (integral[0] + u * (integral[1] + u * (integral[2] + u * (integral[3] + u * integral[4])))) - start;
+    }
+
+    //parameter where the curve has covered distance inside span. Newton steps on the fitted speed, kept inside the span by
+    //bisection, solve for it without evaluating the curve
+    float spanParameter(int span, float distance) {
+        const float* fit = &speedFits[5 * span];
+        float integral[5] = { fit[0], fit[1] / 2, fit[2] / 3, fit[3] / 4, fit[4] / 5 };
+        //the antiderivative is 0 at the start of the span, u = -1
+        float start = -integral[0] + integral[1] - integral[2] + integral[3] - integral[4];
+        float spanTotal = fitLength(integral, start, 1);
+        float lo = -1, hi = 1;
+        float u = spanTotal > 0 ? fminf(fmaxf(2 * distance / spanTotal - 1, -1.0f), 1.0f) : -1;
+        for (int i = 0; i < 8; i++) {
+            float error = fitLength(integral, start, u) - distance;
+            if (fabsf(error) <= 1e-5f * spanTotal) {
+                break;
+            }
+            if (error > 0) {
+                hi = u;
+            }
+            else {
+                lo = u;
+            }
+            float speed = fit[0] + u * (fit[1] + u * (fit[2] + u * (fit[3] + u * fit[4])));
+            float next = speed > 1e-9f ? u - error / speed : (lo + hi) / 2;
+            u = (next > lo && next < hi) ? next : (lo + hi) / 2;
+        }
+        return (span + (u + 1) / 2) * 5 / speedFits.size();
+    }
+
+    //number of spans in the arc length table
+    virtual int arcLengthSpanCount() {
+        return 16;
+    }
+
+    virtual void buildArcLengthTable(std::vector<float>& table) {
+        int arcLengthSpans = arcLengthSpanCount();
+        table.resize(arcLengthSpans);
+        speedFits.resize(5 * arcLengthSpans);
+        float total = 0;
+        for (int k = 0; k < arcLengthSpans; k++) {
+            total += fitSpan((float)k / arcLengthSpans, (float)(k + 1) / arcLengthSpans, &speedFits[5 * k]);
+            table[k] = total;
+        }
+    }
+
+    const std::vector<float>& getArcLengths() {
+        if (!arcLengthsValid) {
+            buildArcLengthTable(arcLengths);
+            arcLengthsValid = true;
+        }
+        return arcLengths;
+    }
+
+    //samples are spaced this far apart along the curve (in viewport units, about 10 pixels), so every point of the
+    //curve is within the 0.05 mouseOverCurve tolerance of a sample
+    static constexpr float sampleSpacing = 0.03f;
+
+    void computeBounds() {
+        boundsValid = true;
+        if (samples.empty()) {
+            boundsMin = boundsMax = float2(0.0, 0.0);
+            return;
+        }
+        boundsMin = boundsMax = samples.at(0);
+        for (unsigned int i = 1; i < samples.size(); i++) {
+            boundsMin.x = fminf(boundsMin.x, samples[i].x);
+            boundsMin.y = fminf(boundsMin.y, samples[i].y);
+            boundsMax.x = fmaxf(boundsMax.x, samples[i].x);
+            boundsMax.y = fmaxf(boundsMax.y, samples[i].y);
+        }
+    }
+
+public:
+
+    //fills out with the points that the stroke and mouseOverCurve walk along, evenly spaced by arc length, and tangents
+    //with the derivatives there unless it is NULL
+    virtual void tessellate(std::vector<float2>& out, std::vector<float2>* tangents) {
+        int count = (int)ceilf(length() / sampleSpacing) + 1;
+        sampleUniformly(count < 8 ? 8 : (count > 1000 ? 1000 : count), out, tangents);
+    }
+
+    int getCurveType() {
+        return curveType;
+    }
+    
+    virtual float2 getPoint(float t)=0;
+
+    virtual float2 getDerivative(float t)=0;
+    
+    void setSelected() {
+        selected = true;
+    }
+    
+    void setUnSelected() {
+        selected = false;
+    }
+
+    //must be called whenever the control points change
+    void invalidate() {
+        samplesValid = false;
+        boundsValid = false;
+        arcLengthsValid = false;
+        strokeValid = false;
+    }
+
+    const std::vector<float2>& getSamples() {
+        if (!samplesValid) {
+            tessellate(samples, &sampleTangents);
+            samplesValid = true;
+        }
+        return samples;
+    }
+
+    //triangle strip covering the curve width pixels wide, rebuilt only when the samples, width or pixel scale change
+    const std::vector<float2>& getStroke(float width, float2 pixelsPerUnit) {
+        getSamples();
+        if (!strokeValid || width != strokeWidth || pixelsPerUnit.x != strokePixelsPerUnit.x || pixelsPerUnit.y != strokePixelsPerUnit.y) {
+            stroke.clear();
+            buildStrokeStrip(samples, sampleTangents, width, pixelsPerUnit, stroke);
+            strokeWidth = width;
+            strokePixelsPerUnit = pixelsPerUnit;
+            strokeValid = true;
+            strokeVersion = newStrokeVersion();
+        }
+        return stroke;
+    }
+
+    unsigned int getStrokeVersion() {
+        return strokeVersion;
+    }
+
+    //fills color with the curve's color and returns its width in pixels.
+    //selected curves are blue and widest, the multi-selection cyan, everything else colored by curve type
+    float getStrokeStyle(float color[3]) {
+        if (selected) {
+            color[0] = 0.0f; color[1] = 0.0f; color[2] = 1.0f;
+            return 6;
+        }
+        if (inSelection) {
+            color[0] = 0.0f; color[1] = 1.0f; color[2] = 1.0f;
+            return 4;
+        }
+        //polyline coloring
+        if (curveType == 0) {
+            color1 = 0.6;
+            color2 = 0.1;
+            color3 = 0.8;
+        }
+        //bezier coloring
+        else if (curveType == 1) {
+            color1 = 0.2;
+            color2 = 0.9;
+            color3 = 0.2;
+        }
+        //lagrange coloring
+        else {
+            color1 = 1.0;
+            color2 = 0.4;
+            color3 = 0.7;
+        }
+        color[0] = color1; color[1] = color2; color[2] = color3;
+        return 3;
+    }
+
+    //all curve types are affine invariant, so after a rotation or translation the existing tessellation can be moved along
+    //with the control points instead of being rebuilt, and lengths stay the same. any other transform changes how many
+    //samples the curve needs, so the samples are rebuilt.
+    //the stroke moves along too when its width in pixels stays the same: always for translations, and for rotations only
+    //when pixels are square
+    void transformSamples(const AffineTransform& transform) {
+        if (samplesValid && transform.isRigid()) {
+            transform.apply(samples);
+            for (unsigned int i = 0; i < sampleTangents.size(); i++) {
+                sampleTangents[i] = transform.applyToVector(sampleTangents[i]);
+            }
+            if (strokeValid && (transform.isTranslation() || strokePixelsPerUnit.x == strokePixelsPerUnit.y)) {
+                transform.apply(stroke);
+                strokeVersion = newStrokeVersion();
+            }
+            else {
+                strokeValid = false;
+            }
+        }
+        else {
+            samplesValid = false;
+            arcLengthsValid = false;
+            strokeValid = false;
+        }
+        boundsValid = false;
+    }
+
+    float length() {
+        const std::vector<float>& table = getArcLengths();
+        return table.empty() ? 0 : table.back();
+    }
+
+    //parameter t where the curve has covered distance s from its start. the span is found by binary search in the
+    //arc length table, and t inside it from the span's fitted speed
+    virtual float parameterAtDistance(float s) {
+        const std::vector<float>& table = getArcLengths();
+        if (table.empty() || s <= 0) {
+            return 0;
+        }
+        if (s >= table.back()) {
+            return 1;
+        }
+        int span = std::upper_bound(table.begin(), table.end(), s) - table.begin();
+        return spanParameter(span, s - (span == 0 ? 0 : table[span - 1]));
+    }
+
+    virtual float2 pointAtDistance(float s) {
+        return getPoint(parameterAtDistance(s));
+    }
+
+    //count points evenly spaced along the curve, both ends included, and the derivatives there if tangents is given.
+    //the samples walk through the arc length table in order, so each one only looks at the span it falls in
+    virtual void sampleUniformly(int count, std::vector<float2>& out, std::vector<float2>* tangents = NULL) {
+        const std::vector<float>& table = getArcLengths();
+        out.clear();
+        if (tangents != NULL) {
+            tangents->clear();
+        }
+        float total = table.empty() ? 0 : table.back();
+        int span = 0;
+        for (int i = 0; i < count; i++) {
+            float s = count > 1 ? total * i / (count - 1) : 0;
+            while (span < (int)table.size() - 1 && table[span] < s) {
+                span++;
+            }
+            float t = 0;
+            if (i == count - 1 && count > 1) {
+                t = 1;
+            }
+            else if (!table.empty()) {
+                t = spanParameter(span, s - (span == 0 ? 0 : table[span - 1]));
+            }
+            out.push_back(getPoint(t));
+            if (tangents != NULL) {
+                tangents->push_back(getDerivative(t));
+            }
+        }
+    }
+
+    //Liang-Barsky clipping: returns true if the segment from a to b has a part inside the rectangle spanned by lo and hi.
+    //each side of the rectangle narrows the parameter range of the segment that lies on its inner side
+    static bool segmentIntersectsRectangle(float2 a, float2 b, float2 lo, float2 hi) {
+        float2 direction = b - a;
+        float p[4] = { -direction.x, direction.x, -direction.y, direction.y };
+        float q[4] = { a.x - lo.x, hi.x - a.x, a.y - lo.y, hi.y - a.y };
+        float enter = 0, leave = 1;
+        for (int side = 0; side < 4; side++) {
+            if (p[side] == 0) {
+                //parallel to this side, so either entirely inside or entirely outside of it
+                if (q[side] < 0) {
+                    return false;
+                }
+            }
+            else if (p[side] < 0) {
+                enter = fmaxf(enter, q[side] / p[side]);
+            }
+            else {
+                leave = fminf(leave, q[side] / p[side]);
+            }
+        }
+        return enter <= leave;
+    }
+
+    //returns true if the curve passes through the rectangle spanned by lo and hi: some segment between neighbouring samples
+    //crosses it, which for polylines is exact
+    bool intersectsRectangle(float2 lo, float2 hi) {
+        const std::vector<float2>& points = getSamples();
+        if (!boundsValid) {
+            computeBounds();
+        }
+        if (points.empty() || boundsMax.x < lo.x || boundsMin.x > hi.x || boundsMax.y < lo.y || boundsMin.y > hi.y) {
+            return false;
+        }
+        if (points.size() == 1) {
+            return segmentIntersectsRectangle(points[0], points[0], lo, hi);
+        }
+        for (unsigned int i = 1; i < points.size(); i++) {
+            if (segmentIntersectsRectangle(points[i - 1], points[i], lo, hi)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+
+    //mouseOverCurve: takes in cursor position and returns true if mouse is over current curve
+    //input: current x and y position of the mouse
+    //output: True if mouse is over this curve, false otherwise.
+    virtual bool mouseOverCurve(float mouseX, float mouseY) {
+
+        const std::vector<float2>& points = getSamples();
+        for (unsigned int i = 0; i < points.size(); i++) {
+            //get each point
+            float2 point = points[i];
+            float pointX = point.x;
+            float pointY = point.y;
+
+            //difference between mouseX and that point x
+            float differenceBetweenX = mouseX - pointX;
+            float differenceBetweenY = mouseY - pointY;
+            
+            //if the difference is marginal, return true. else return false
+            if (fabs(differenceBetweenX) < .05 && fabs(differenceBetweenY) < .05) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+
+/**
+Freeform class. Contains additional methods for dealing with control points: getting, setting, replacing, deleting, drawing.
+ */
+class Freeform : public Curve
+{
+
+protected:
+    //type and control points of the curve. scene snapshots share this record instead of copying it (see freeze), and the
+    //first edit after that gives the curve a copy of its own, so a snapshot never sees later edits
+    std::shared_ptr<const CurveRecord> record;
+    std::vector<int> controlPointsNearClick;
+
+    //the record to change the control points in. callers invalidate whatever they don't update themselves
+    CurveRecord& editRecord() {
+        if (record.use_count() > 1) {
+            record = std::make_shared<CurveRecord>(*record);
+        }
+        //records are always created non-const, and no snapshot holds this one
+        return const_cast<CurveRecord&>(*record);
+    }
+    
+public:
+    
+    Freeform(int curveType) : Curve(curveType), record(std::make_shared<CurveRecord>(curveType)) {}
+
+    virtual float2 getPoint(float t)=0;
+    
+    void addControlPoint(float2 p)
+    {
+        editRecord().addPoint(p);
+        invalidate();
+    }
+    
+    float2 getControlPoint(int index) {
+        if (index < 0 || index >= getControlPointsSize()) {
+            throw std::out_of_range("control point index");
+        }
+        return record->point(index);
+    }
+    
+    void setNewControlPointValue(int index, float2 newValue) {
+        editRecord().setPoint(index, newValue);
+        invalidate();
+    }
+    
+    void eraseControlPoint(int point) {
+        editRecord().erasePoint(point);
+        invalidate();
+    }
+
+    //replaces the control points, keeping the storage mode of the curve
+    void setControlPoints(const std::vector<float2>& points) {
+        editRecord().setControlPoints(points, record->isCompact());
+        invalidate();
+    }
+
+    //with compact set, the control points are kept quantized (see CompactPoints) as long as they lie in the viewport square
+    void setCompactStorage(bool compact) {
+        if (compact != record->isCompact()) {
+            std::vector<float2> points;
+            getControlPoints(points);
+            editRecord().setControlPoints(points, compact);
+        }
+    }
+
+    //applies transform to every control point, and moves the cached tessellation along with them
+    void transformControlPoints(const AffineTransform& transform) {
+        CurveRecord& edited = editRecord();
+        edited.transform(edited, transform);
+        transformSamples(transform);
+    }
+
+    //for drags: sets the control points to origin's, the record the drag started from, with total applied, and moves the
+    //cached tessellation by step, the part of total since the last call. starting over from origin every time rounds
+    //compact points once per step instead of adding up the rounding of all steps
+    void transformControlPoints(const CurveRecord& origin, const AffineTransform& total, const AffineTransform& step) {
+        editRecord().transform(origin, total);
+        transformSamples(step);
+    }
+    
+#ifndef CURVES_HEADLESS
+    void drawControlPoints(){
+        if (selected) {
+            glBegin(GL_POINTS);
+            for (int i = 0; i < getControlPointsSize(); i++) {
+                float2 point = getControlPoint(i);
+                float x = point.x;
+                float y = point.y;
+                glVertex2d(x, y);
+                
+            }
+            glEnd();
+        }
+    }
+#endif
+    
+    int getControlPointsSize() {
+        return record->pointCount();
+    }
+
+    //more control points let the curve turn more often, so the arc length table gets more spans. every span evaluates the
+    //derivative, which reads all control points, so they are capped to keep tables of long curves from taking quadratic time
+    int arcLengthSpanCount() {
+        return std::min(std::max(16, 4 * getControlPointsSize()), 256);
+    }
+
+    void getControlPoints(std::vector<float2>& out) {
+        record->getControlPoints(out);
+    }
+
+    //returns a record of the current state, which is the curve's own record: taking it costs nothing, and unchanged curves
+    //keep returning the same one
+    CurveRecordPtr freeze() {
+        return record;
+    }
+
+    //used when restoring a snapshot or loading a file: the curve takes over newRecord as its storage
+    void setRecord(const CurveRecordPtr& newRecord) {
+        record = newRecord;
+        invalidate();
+    }
+    
+    //get closest control point to mouse
+    //returns point that's closest or -1 if no point is close enough
+    int getControlPointNearMouse(float x, float y) {
+        for (int i = 0; i < getControlPointsSize(); i++) {
+            float ctrlPtX = getControlPoint(i).x;
+            float ctrlPtY = getControlPoint(i).y;
+            
+            //if difference is marginal, return that control point. else return -1
+            if ((fabs(ctrlPtX - x) < 0.05f && fabs(ctrlPtY - y) < 0.05f)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+/**
+ Polyline class: draws a new polyline where control points are clicked.
+ */
+class Polyline : public Freeform {
+public:
+   // curveType = 0;
+    Polyline() : Freeform(0.0) {}
+    
+    //parameterized by the fraction t of its length, to match getDerivative
+    float2 getPoint(float t) {
+        return pointAtDistance(t * length());
+    }
+
+    //a polyline is sampled exactly at its control points. it has no derivative at its corners, so the stroke gets joins there
+    void tessellate(std::vector<float2>& out, std::vector<float2>* tangents) {
+        getControlPoints(out);
+        if (tangents != NULL) {
+            tangents->clear();
+        }
+    }
+
+    //one span per segment, measured exactly
+    void buildArcLengthTable(std::vector<float>& table) {
+        table.clear();
+        float total = 0;
+        for (int i = 1; i < getControlPointsSize(); i++) {
+            total += (getControlPoint(i) - getControlPoint(i - 1)).norm();
+            table.push_back(total);
+        }
+    }
+
+    //polylines have no curve parameter, so t is the fraction of the length
+    float parameterAtDistance(float s) {
+        float total = length();
+        return total > 0 ? fminf(fmaxf(s / total, 0.0f), 1.0f) : 0;
+    }
+
+    //index of the segment containing distance s, or -1 for a polyline without segments
+    int segmentAtDistance(float s) {
+        const std::vector<float>& table = getArcLengths();
+        if (table.empty()) {
+            return -1;
+        }
+        int segment = std::lower_bound(table.begin(), table.end(), s) - table.begin();
+        return segment < (int)table.size() ? segment : table.size() - 1;
+    }
+
+    //derivative with respect to the length fraction t: the direction of the segment, scaled by the total length
+    float2 getDerivative(float t) {
+        int segment = segmentAtDistance(t * length());
+        if (segment == -1) {
+            return float2(0.0, 0.0);
+        }
+        float2 direction = getControlPoint(segment + 1) - getControlPoint(segment);
+        float segmentLength = direction.norm();
+        return segmentLength > 0 ? direction * (length() / segmentLength) : float2(0.0, 0.0);
+    }
+
+    float2 pointAtDistance(float s) {
+        const std::vector<float>& table = getArcLengths();
+        if (table.empty()) {
+            return getControlPointsSize() == 0 ? float2(0.0, 0.0) : getControlPoint(0);
+        }
+        s = fminf(fmaxf(s, 0.0f), table.back());
+        int segment = segmentAtDistance(s);
+        float segmentStart = segment == 0 ? 0 : table[segment - 1];
+        float segmentLength = table[segment] - segmentStart;
+        float fraction = segmentLength > 0 ? (s - segmentStart) / segmentLength : 0;
+        float2 start = getControlPoint(segment);
+        return start + (getControlPoint(segment + 1) - start) * fraction;
+    }
+
+    void sampleUniformly(int count, std::vector<float2>& out, std::vector<float2>* tangents = NULL) {
+        out.clear();
+        if (tangents != NULL) {
+            tangents->clear();
+        }
+        float total = length();
+        for (int i = 0; i < count; i++) {
+            float s = count > 1 ? total * i / (count - 1) : 0;
+            out.push_back(pointAtDistance(s));
+            if (tangents != NULL) {
+                tangents->push_back(getDerivative(total > 0 ? s / total : 0));
+            }
+        }
+    }
+
+    //Ramer-Douglas-Peucker simplification: drops every control point that is closer than tolerance to the simplified line.
+    //uses an explicit stack instead of recursion so very dense input can't overflow the call stack. returns the number of points removed
+    int simplify(float tolerance) {
+        std::vector<float2> controlPoints;
+        getControlPoints(controlPoints);
+        int pointCount = controlPoints.size();
+        if (pointCount < 3) {
+            return 0;
+        }
+        std::vector<bool> keep(pointCount, false);
+        keep[0] = keep[pointCount - 1] = true;
+        std::vector<std::pair<int, int> > spans;
+        spans.push_back(std::make_pair(0, pointCount - 1));
+        float tolerance2 = tolerance * tolerance;
+        while (!spans.empty()) {
+            int first = spans.back().first;
+            int last = spans.back().second;
+            spans.pop_back();
+            int farthest = -1;
+            float farthestDistance2 = tolerance2;
+            for (int i = first + 1; i < last; i++) {
+                float distance2 = distanceToSegment2(controlPoints[i], controlPoints[first], controlPoints[last]);
+                if (distance2 > farthestDistance2) {
+                    farthestDistance2 = distance2;
+                    farthest = i;
+                }
+            }
+            if (farthest != -1) {
+                keep[farthest] = true;
+                spans.push_back(std::make_pair(first, farthest));
+                spans.push_back(std::make_pair(farthest, last));
+            }
+        }
+        std::vector<float2> simplified;
+        for (int i = 0; i < pointCount; i++) {
+            if (keep[i]) {
+                simplified.push_back(controlPoints[i]);
+            }
+        }
+        setControlPoints(simplified);
+        return pointCount - simplified.size();
+    }
+
+    //squared distance from p to the segment between a and b
+    static float distanceToSegment2(float2 p, float2 a, float2 b) {
+        float2 segment = b - a;
+        float length2 = segment.norm2();
+        float t = length2 > 0 ? (p - a).dot(segment) / length2 : 0;
+        t = fminf(fmaxf(t, 0.0f), 1.0f);
+        float2 difference = p - (a + segment * t);
+        return difference.norm2();
+    }
+    
+    
+    //check if mouse is over curve. since we don't have a getPoint function for polyline, have to do this a little differently
+    bool mouseOverCurve(float mouseX, float mouseY) {
+        for (int i = 0; i < getControlPointsSize() -1; i++) {
+            bool doesPointExist = pointBetweenCtrlPoints(getControlPoint(i), getControlPoint(i+1), mouseX, mouseY);
+            if (doesPointExist) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    
+    //idea for equation from: http://stackoverflow.com/questions/328107/how-can-you-determine-a-point-is-between-two-other-points-on-a-line-segment
+    bool pointBetweenCtrlPoints(float2 ctrlPoint1, float2 ctrlPoint2, float mouseX, float mouseY) {
+        //first, check if cross product of (b-a) and (c-a) is 0
+        float crossProduct = (mouseY - ctrlPoint1.y) * (ctrlPoint2.x - ctrlPoint1.x) - (mouseX - ctrlPoint1.x) * (ctrlPoint2.y - ctrlPoint1.y);
+        if (fabs(crossProduct) > 0.05){
+            return false;
+        }
+        
+        //next, check if dot product is positive
+        float dotProduct = (mouseX - ctrlPoint1.x) * (ctrlPoint2.x - ctrlPoint1.x) + (mouseY - ctrlPoint1.y)*(ctrlPoint2.y - ctrlPoint1.y);
+        if (dotProduct < 0) {
+            return false;
+        }
+        
+        //now, check that dot product is less than square of distance between ctrlPoint1 and ctrlPoint2
+        float lengthSquared = (ctrlPoint2.x - ctrlPoint1.x) * (ctrlPoint2.x - ctrlPoint1.x) + (ctrlPoint2.y - ctrlPoint1.y) * (ctrlPoint2.y - ctrlPoint1.y);
+        if (dotProduct > lengthSquared) {
+            return false;
+        }
+        return true;
+    }
+
+    
+};
+
+/**
+ BezierCurve: extends freeform and implements curve using Bezier interpolation
+ */
+class BezierCurve : public Freeform
+
+{
+    public:
+    BezierCurve() : Freeform(1.0) {}
+
+    //de Casteljau's algorithm: repeated linear interpolation between neighbouring points, in place.
+    //takes quadratic time in the number of points and is stable for any degree
+    static float2 deCasteljau(float2* points, int count, float t) {
+        for (int level = count - 1; level > 0; level--) {
+            for (int i = 0; i < level; i++) {
+                points[i] = points[i] * (1 - t) + points[i + 1] * t;
+            }
+        }
+        return points[0];
+    }
+
+    float2 getPoint(float t) //calculates a point from the control points
+    {
+        int n = getControlPointsSize();
+        if (n == 0) {
+            return float2(0.0, 0.0);
+        }
+        //curves drawn by hand fit on the stack
+        float2 local[16];
+        std::vector<float2> heap;
+        float2* points = local;
+        if (n > 16) {
+            heap.resize(n);
+            points = &heap[0];
+        }
+        for (int i = 0; i < n; i++) {
+            points[i] = getControlPoint(i);
+        }
+        return deCasteljau(points, n, t);
+    }
+
+    //the Bernstein sum over count points in linear time. its weights (n choose i) t^i (1-t)^(n-i) are, up to a shared factor,
+    //(n choose i) s^i with s = t / (1-t) counted from the first point, or (1-t) / t from the last one when t is past the
+    //middle, so s stays at most 1. all of them are positive, and dividing by their sum removes the shared factor without
+    //cancellation. used for arc length tables, which evaluate the derivative a few hundred times
+    static float2 bernstein(const float2* points, int count, float t) {
+        int n = count - 1;
+        bool fromEnd = t > 0.5f;
+        double s = fromEnd ? (1.0 - t) / t : t / (1.0 - t);
+        double weight = 1, sum = 0, sumX = 0, sumY = 0;
+        for (int i = 0; i <= n; i++) {
+            const float2& p = points[fromEnd ? n - i : i];
+            sum += weight;
+            sumX += weight * p.x;
+            sumY += weight * p.y;
+            weight *= s * (n - i) / (i + 1);
+            //binomials of long curves overflow doubles, so every sum is scaled down together
+            if (weight > 1e250) {
+                weight *= 1e-250;
+                sum *= 1e-250;
+                sumX *= 1e-250;
+                sumY *= 1e-250;
+            }
+        }
+        return float2(sumX / sum, sumY / sum);
+    }
+
+    //derivative of a degree n Bezier curve: n times the degree n-1 curve over the differences of neighbouring control points
+    float2 getDerivative(float t)
+    {
+        int n = getControlPointsSize() - 1;
+        if (n < 1) {
+            return float2(0.0, 0.0);
+        }
+        float2 local[16];
+        std::vector<float2> heap;
+        float2* differences = local;
+        if (n > 16) {
+            heap.resize(n);
+            differences = &heap[0];
+        }
+        for (int i = 0; i < n; i++) {
+            differences[i] = getControlPoint(i + 1) - getControlPoint(i);
+        }
+        return bernstein(differences, n, t) * (float)n;
+    }
+};
+
+/**
+ BezierFitter: fits a chain of cubic Bezier curves to a sequence of points, following Schneider's algorithm
+ ("An Algorithm for Automatically Fitting Digitized Curves", Graphics Gems 1990). Every input point ends up within
+ maxError of its fitted curve; spans that can't be fitted are split at the worst point until they can.
+ */
+class BezierFitter {
+    std::vector<float2> points;
+    float maxError;
+    std::vector<BezierCurve*> fitted;
+
+    static float2 cubicPoint(const float2* bezier, float t) {
+        float s = 1 - t;
+        return bezier[0] * (s * s * s) + bezier[1] * (3 * s * s * t) + bezier[2] * (3 * s * t * t) + bezier[3] * (t * t * t);
+    }
+
+    static float2 cubicDerivative(const float2* bezier, float t) {
+        float s = 1 - t;
+        return (bezier[1] - bezier[0]) * (3 * s * s) + (bezier[2] - bezier[1]) * (6 * s * t) + (bezier[3] - bezier[2]) * (3 * t * t);
+    }
+
+    static float2 cubicSecondDerivative(const float2* bezier, float t) {
+        return (bezier[2] - bezier[1] * 2 + bezier[0]) * (6 * (1 - t)) + (bezier[3] - bezier[2] * 2 + bezier[1]) * (6 * t);
+    }
+
+    //unit vector in direction, or fallback if direction is too short to normalize
+    static float2 unit(float2 direction, float2 fallback) {
+        if (direction.norm2() < 1e-20f) {
+            return fallback;
+        }
+        return direction.normalize();
+    }
+
+    void emit(const float2* bezier) {
+        BezierCurve* curve = new BezierCurve();
+        for (int i = 0; i < 4; i++) {
+            curve->addControlPoint(bezier[i]);
+        }
+        fitted.push_back(curve);
+    }
+
+    //least squares fit of the inner control points, with the end tangent directions fixed
+    void generateBezier(int first, int last, const std::vector<float>& u, float2 tangent1, float2 tangent2, float2* bezier) {
+        float c00 = 0, c01 = 0, c11 = 0, x0 = 0, x1 = 0;
+        float2 p0 = points[first];
+        float2 p3 = points[last];
+        for (int i = 0; i <= last - first; i++) {
+            float t = u[i];
+            float s = 1 - t;
+            float b0 = s * s * s, b1 = 3 * s * s * t, b2 = 3 * s * t * t, b3 = t * t * t;
+            float2 a1 = tangent1 * b1;
+            float2 a2 = tangent2 * b2;
+            c00 += a1.dot(a1);
+            c01 += a1.dot(a2);
+            c11 += a2.dot(a2);
+            float2 residual = points[first + i] - (p0 * (b0 + b1) + p3 * (b2 + b3));
+            x0 += a1.dot(residual);
+            x1 += a2.dot(residual);
+        }
+        float determinant = c00 * c11 - c01 * c01;
+        float alpha1 = 0, alpha2 = 0;
+        if (fabs(determinant) > 1e-12f) {
+            alpha1 = (x0 * c11 - x1 * c01) / determinant;
+            alpha2 = (c00 * x1 - c01 * x0) / determinant;
+        }
+        //degenerate or backwards solutions fall back to Wu/Barsky's heuristic of a third of the chord
+        float chord = (p3 - p0).norm();
+        float epsilon = 1e-6f * chord;
+        if (alpha1 < epsilon || alpha2 < epsilon) {
+            alpha1 = alpha2 = chord / 3;
+        }
+        bezier[0] = p0;
+        bezier[1] = p0 + tangent1 * alpha1;
+        bezier[2] = p3 + tangent2 * alpha2;
+        bezier[3] = p3;
+    }
+
+    //largest squared distance between a point and the curve at its parameter. splitPoint receives the index of that point
+    float computeMaxError(int first, int last, const float2* bezier, const std::vector<float>& u, int& splitPoint) {
+        float maxDistance2 = 0;
+        splitPoint = (first + last) / 2;
+        for (int i = first + 1; i < last; i++) {
+            float distance2 = (cubicPoint(bezier, u[i - first]) - points[i]).norm2();
+            if (distance2 >= maxDistance2) {
+                maxDistance2 = distance2;
+                splitPoint = i;
+            }
+        }
+        return maxDistance2;
+    }
+
+    //one Newton-Raphson step per point towards the parameter of the closest curve point
+    void reparameterize(int first, int last, const float2* bezier, std::vector<float>& u) {
+        for (int i = 0; i <= last - first; i++) {
+            float2 offset = cubicPoint(bezier, u[i]) - points[first + i];
+            float2 derivative = cubicDerivative(bezier, u[i]);
+            float2 secondDerivative = cubicSecondDerivative(bezier, u[i]);
+            float numerator = offset.dot(derivative);
+            float denominator = derivative.dot(derivative) + offset.dot(secondDerivative);
+            if (fabs(denominator) > 1e-12f) {
+                u[i] = fminf(fmaxf(u[i] - numerator / denominator, 0.0f), 1.0f);
+            }
+        }
+    }
+
+    void fitCubic(int first, int last, float2 tangent1, float2 tangent2) {
+        float2 bezier[4];
+        if (last - first == 1) {
+            float third = (points[last] - points[first]).norm() / 3;
+            bezier[0] = points[first];
+            bezier[1] = points[first] + tangent1 * third;
+            bezier[2] = points[last] + tangent2 * third;
+            bezier[3] = points[last];
+            emit(bezier);
+            return;
+        }
+
+        //chord length parameterization
+        std::vector<float> u(last - first + 1, 0.0f);
+        for (int i = first + 1; i <= last; i++) {
+            u[i - first] = u[i - first - 1] + (points[i] - points[i - 1]).norm();
+        }
+        for (int i = 1; i <= last - first; i++) {
+            u[i] /= u[last - first];
+        }
+
+        float error2 = maxError * maxError;
+        int splitPoint;
+        generateBezier(first, last, u, tangent1, tangent2, bezier);
+        float currentError2 = computeMaxError(first, last, bezier, u, splitPoint);
+        if (currentError2 < error2) {
+            emit(bezier);
+            return;
+        }
+
+        //if the fit is close, a few rounds of reparameterization usually bring it within tolerance
+        if (currentError2 < error2 * 16) {
+            for (int iteration = 0; iteration < 4; iteration++) {
+                reparameterize(first, last, bezier, u);
+                generateBezier(first, last, u, tangent1, tangent2, bezier);
+                currentError2 = computeMaxError(first, last, bezier, u, splitPoint);
+                if (currentError2 < error2) {
+                    emit(bezier);
+                    return;
+                }
+            }
+        }
+
+        //split at the worst point and fit both halves, sharing the tangent there so the chain stays smooth
+        float2 centerTangent = unit(points[splitPoint - 1] - points[splitPoint + 1], -tangent1);
+        fitCubic(first, splitPoint, tangent1, centerTangent);
+        fitCubic(splitPoint, last, -centerTangent, tangent2);
+    }
+
+public:
+    BezierFitter(const std::vector<float2>& input, float maxError) : maxError(maxError) {
+        //repeated points have no chord length and would break the parameterization
+        for (unsigned int i = 0; i < input.size(); i++) {
+            if (points.empty() || (input[i] - points.back()).norm2() > 1e-12f) {
+                points.push_back(input[i]);
+            }
+        }
+    }
+
+    //returns newly allocated curves, in order along the input
+    std::vector<BezierCurve*> fit() {
+        fitted.clear();
+        int last = points.size() - 1;
+        if (last < 1) {
+            return fitted;
+        }
+        float2 chord = points[last] - points[0];
+        float2 tangent1 = unit(points[1] - points[0], chord);
+        float2 tangent2 = unit(points[last - 1] - points[last], -chord);
+        fitCubic(0, last, tangent1, tangent2);
+        return fitted;
+    }
+};
+
+/**
+ LagrangeCurve: extends freeform and implements curve using Lagrange interpolation
+ */
+class LagrangeCurve : public Freeform
+{
+public:
+    LagrangeCurve() : Freeform(2) {}
+    
+    //knots are spread evenly over [0,1], one per control point
+    double knot(int i) {
+        int vecSize = getControlPointsSize();
+        return vecSize == 1 ? 0 : (double)i / (vecSize - 1);
+    }
+    
+    //barycentric weight of control point i, up to a factor shared by all of them: (-1)^i (n-1 choose i) for even knots.
+    //next is the weight of control point i + 1
+    static double nextWeight(double weight, int i, int n) {
+        return -weight * (n - 1 - i) / (i + 1);
+    }
+
+    //derivative of the basis polynomial of control point i, by the product rule over its factors (t - knot j) / (knot i - knot j)
+    double lagrangeDerivative(int i, double t) {
+        int n = getControlPointsSize();
+        double numerator = 0;
+        double denominator = 1;
+        for (int k = 0; k < n; k++) {
+            if (k == i) {
+                continue;
+            }
+            denominator *= knot(i) - knot(k);
+            double term = 1;
+            for (int j = 0; j < n; j++) {
+                if (j != i && j != k) {
+                    term *= t - knot(j);
+                }
+            }
+            numerator += term;
+        }
+        return numerator / denominator;
+    }
+
+    //index of the knot within 1e-6 of t, or -1. a curve with a single control point is that point everywhere
+    int knotAt(double t) {
+        int n = getControlPointsSize();
+        if (n < 2) {
+            return n - 1;
+        }
+        int i = (int)lround(t * (n - 1));
+        return (i >= 0 && i < n && fabs(t - knot(i)) < 1e-6) ? i : -1;
+    }
+
+    //barycentric form: with a_i = w_i / (t - knot i), the curve is r = sum(a_i p_i) / sum(a_i). its derivative,
+    //sum(a_i (r - p_i) / (t - knot i)) / sum(a_i), is gathered in the same loop when derivative is given. takes linear time,
+    //but t must not be at a knot
+    void barycentric(double t, double point[2], double* derivative = NULL) {
+        int n = getControlPointsSize();
+        double knotStep = 1.0 / (n - 1);
+        double sum = 0, sumX = 0, sumY = 0;
+        double slopeSum = 0, slopeX = 0, slopeY = 0;
+        double weight = 1;
+        for (int i = 0; i < n; i++) {
+            double factor = t - i * knotStep;
+            double a = weight / factor;
+            float2 p = getControlPoint(i);
+            sum += a;
+            sumX += a * p.x;
+            sumY += a * p.y;
+            double slope = a / factor;
+            slopeSum += slope;
+            slopeX += slope * p.x;
+            slopeY += slope * p.y;
+            weight = nextWeight(weight, i, n);
+        }
+        point[0] = sumX / sum;
+        point[1] = sumY / sum;
+        if (derivative != NULL) {
+            derivative[0] = (point[0] * slopeSum - slopeX) / sum;
+            derivative[1] = (point[1] * slopeSum - slopeY) / sum;
+        }
+    }
+
+    //at a knot the barycentric terms are singular, so the derivative comes from the product rule
+    float2 getDerivative(float t) {
+        int n = getControlPointsSize();
+        if (knotAt(t) != -1) {
+            float2 r(0.0, 0.0);
+            for (int i = 0; i < n; i++) {
+                r += getControlPoint(i) * (float)lagrangeDerivative(i, t);
+            }
+            return r;
+        }
+        double point[2], derivative[2];
+        barycentric(t, point, derivative);
+        return float2(derivative[0], derivative[1]);
+    }
+    
+    float2 getPoint(float t) //calculates a point from the control points
+    {
+        if (getControlPointsSize() == 0) {
+            return float2(0.0, 0.0);
+        }
+        int i = knotAt(t);
+        if (i != -1) {
+            return getControlPoint(i);
+        }
+        double point[2];
+        barycentric(t, point);
+        return float2(point[0], point[1]);
+    }
+};
+
+
+//creates a live curve from a record, e.g. when restoring a snapshot or loading a file. returns NULL for unknown curve types
+inline Freeform* createCurve(const CurveRecordPtr& record) {
+    Freeform* curve;
+    switch (record->curveType) {
+        case 0: curve = new Polyline(); break;
+        case 1: curve = new BezierCurve(); break;
+        case 2: curve = new LagrangeCurve(); break;
+        default: return NULL;
+    }
+    curve->setRecord(record);
+    return curve;
+}
+
+//writes one curve per line: curve type, number of control points, then the x y pairs
+inline bool writeCurveRecord(FILE* file, const CurveRecord& record) {
+    std::vector<float2> points;
+    record.getControlPoints(points);
+    if (fprintf(file, "%d %d", record.curveType, (int)points.size()) < 0) {
+        return false;
+    }
+    for (unsigned int i = 0; i < points.size(); i++) {
+        fprintf(file, " %.9g %.9g", points.at(i).x, points.at(i).y);
+    }
+    return fprintf(file, "\n") > 0;
+}
+
+//reads a line written by writeCurveRecord. returns false at end of file or on malformed input
+inline bool readCurveRecord(FILE* file, CurveRecord& record) {
+    int pointCount;
+    if (fscanf(file, "%d %d", &record.curveType, &pointCount) != 2 || pointCount < 0) {
+        return false;
+    }
+    record.setControlPoints(std::vector<float2>(), false);
+    //points are appended as they are read, so a damaged count can't cause a huge allocation
+    for (int i = 0; i < pointCount; i++) {
+        float2 point;
+        if (fscanf(file, "%f %f", &point.x, &point.y) != 2) {
+            return false;
+        }
+        record.controlPoints.push_back(point);
+    }
+    return true;
+}
+
+//compact scene files start with this tag, followed by one binary record per curve
+const char compactSceneTag[4] = { 'C', 'R', 'V', 'Q' };
+
+//binary record for compact scene files: curve type, then the points either compact (see CompactPoints::write)
+//or as encoding 0, point count and raw little endian floats for curves that don't fit the viewport square
+inline bool writeCompactCurveRecord(FILE* file, const CurveRecord& record) {
+    if (fputc(record.curveType, file) == EOF) {
+        return false;
+    }
+    if (record.isCompact()) {
+        //polylines are usually dense, so their small steps between neighbours are delta encoded
+        return record.compactPoints.write(file, record.curveType == 0 ? CompactPoints::DeltaVarint : CompactPoints::Fixed16);
+    }
+    if (fputc(0, file) == EOF || !CompactPoints::writeUint32(file, record.controlPoints.size())) {
+        return false;
+    }
+    for (unsigned int i = 0; i < record.controlPoints.size(); i++) {
+        uint32_t bits[2];
+        memcpy(&bits[0], &record.controlPoints[i].x, 4);
+        memcpy(&bits[1], &record.controlPoints[i].y, 4);
+        if (!CompactPoints::writeUint32(file, bits[0]) || !CompactPoints::writeUint32(file, bits[1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//reads a record written by writeCompactCurveRecord. returns false at end of file or on malformed input
+inline bool readCompactCurveRecord(FILE* file, CurveRecord& record) {
+    int curveType = fgetc(file);
+    if (curveType == EOF) {
+        return false;
+    }
+    record.curveType = curveType;
+    record.setControlPoints(std::vector<float2>(), false);
+    int encoding = fgetc(file);
+    if (encoding != 0) {
+        ungetc(encoding, file);
+        record.compact = true;
+        return record.compactPoints.read(file);
+    }
+    uint32_t pointCount;
+    if (!CompactPoints::readUint32(file, pointCount)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < pointCount; i++) {
+        uint32_t bits[2];
+        if (!CompactPoints::readUint32(file, bits[0]) || !CompactPoints::readUint32(file, bits[1])) {
+            return false;
+        }
+        float2 point;
+        memcpy(&point.x, &bits[0], 4);
+        memcpy(&point.y, &bits[1], 4);
+        record.controlPoints.push_back(point);
+    }
+    return true;
+}
 
 #endif /* defined(__CurvesProject__curves__) */
@@ -91,6 +91,11 @@ public:
         return x*x+y*y;
     }
     
+    float dot(const float2& operand) const
+    {
+        return x * operand.x + y * operand.y;
+    }
+    
     float2 normalize()
     {
         float oneOverLength = 1.0f / norm();
@@ -0,0 +1,314 @@
+//
+//  tessellate.cpp
+//  CurvesProject
+//
+//  Headless batch tessellator: reads curves from stdin, one per line in the scene file format
+//  ("<curve type> <number of control points> x y x y ..."), and writes the polyline each curve is drawn with
+//  to stdout, in input order, as a polyline line of the same format. The output can be loaded by the editor.
+//
+//  Reading, tessellating and writing run as overlapping pipeline stages connected by bounded queues,
+//  so memory stays bounded no matter how long the input is.
+//
+//  Build: c++ -std=c++11 -O2 -pthread tessellate.cpp -o tessellate
+//  Usage: tessellate [-n samples] [-j threads] < scene > polylines
+//  -n writes every curve as that many points (at least 2) at evenly spaced parameters instead of the points the editor
+//  draws. a polyline's parameter is the fraction of its length. -j sets the number of worker threads (at least 1).
+//
+#define CURVES_HEADLESS
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <atomic>
+#include "curves.h"
+
+/**
+ BoundedQueue: blocking FIFO with a fixed capacity. push waits while the queue is full, pop waits while it is empty.
+ After close, pop drains the remaining items and then returns false.
+ */
+template <typename T>
+class BoundedQueue {
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+//a block of whole input lines, and the promise of its tessellated output
+struct Job {
+    std::string text;
+    std::promise<std::string> output;
+};
+
+//small enough that a block of tessellated output, which is many times larger than its input, stays a few megabytes
+const size_t blockSize = 1 << 16;
+int samplesPerCurve = 0;
+std::atomic<int> malformedLines(0);
+
+//parses one input line. line must be null terminated
+bool parseCurveRecord(char* line, CurveRecord& record) {
+    char* end;
+    record.curveType = strtol(line, &end, 10);
+    if (end == line) {
+        return false;
+    }
+    line = end;
+    long pointCount = strtol(line, &end, 10);
+    //every point takes at least four characters, so a larger count can only be garbage
+    if (end == line || pointCount < 0 || pointCount > (long)strlen(end)) {
+        return false;
+    }
+    line = end;
+    record.controlPoints.resize(pointCount);
+    for (long i = 0; i < pointCount; i++) {
+        record.controlPoints[i].x = strtof(line, &end);
+        if (end == line) {
+            return false;
+        }
+        line = end;
+        record.controlPoints[i].y = strtof(line, &end);
+        if (end == line) {
+            return false;
+        }
+        line = end;
+    }
+    return true;
+}
+
+//writes value with 7 decimals, dropping trailing zeros. much faster than printf, which otherwise dominates the run time.
+//that is finer than float resolution inside the [-1,1] viewport; values far outside it fall back to printf
+void appendFloat(float value, std::string& out) {
+    char buffer[32];
+    if (!(fabsf(value) < 1e6f)) {
+        snprintf(buffer, sizeof(buffer), " %.9g", value);
+        out += buffer;
+        return;
+    }
+    //the whole and fractional parts each fit 32 bits, which keeps the digit loops cheap
+    unsigned long long scaled = (unsigned long long)(fabs((double)value) * 1e7 + 0.5);
+    unsigned int whole = (unsigned int)(scaled / 10000000);
+    unsigned int fraction = (unsigned int)(scaled % 10000000);
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    if (fraction != 0) {
+        int digits = 7;
+        while (fraction % 10 == 0) {
+            fraction /= 10;
+            digits--;
+        }
+        while (digits-- > 0) {
+            *--p = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        *--p = '.';
+    }
+    do {
+        *--p = '0' + whole % 10;
+        whole /= 10;
+    } while (whole > 0);
+    if (value < 0 && scaled != 0) {
+        *--p = '-';
+    }
+    *--p = ' ';
+    out.append(p, end - p);
+}
+
+void appendPolyline(const std::vector<float2>& points, std::string& out) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "0 %d", (int)points.size());
+    out += buffer;
+    for (unsigned int i = 0; i < points.size(); i++) {
+        appendFloat(points[i].x, out);
+        appendFloat(points[i].y, out);
+    }
+    out += '\n';
+}
+
+//same samples the editor draws, or samplesPerCurve evenly spaced parameters if -n was given
+void tessellateRecord(const CurveRecordPtr& record, std::vector<float2>& points, std::string& out) {
+    Freeform* curve = createCurve(record);
+    if (curve == NULL) {
+        malformedLines++;
+        out += "0 0\n";
+        return;
+    }
+    if (samplesPerCurve > 0) {
+        points.clear();
+        for (int i = 0; i < samplesPerCurve; i++) {
+            points.push_back(curve->getPoint((float)i / (samplesPerCurve - 1)));
+        }
+        appendPolyline(points, out);
+    }
+    else {
+        //the derivatives the editor keeps for its strokes aren't needed here
+        curve->tessellate(points, NULL);
+        appendPolyline(points, out);
+    }
+    delete curve;
+}
+
+void worker(BoundedQueue<std::shared_ptr<Job> >* jobs) {
+    std::shared_ptr<Job> job;
+    std::vector<float2> points;
+    while (jobs->pop(job)) {
+        std::string out;
+        char* line = &job->text[0];
+        char* textEnd = line + job->text.size();
+        while (line < textEnd) {
+            //every block ends with a line break
+            char* lineEnd = (char*)memchr(line, '\n', textEnd - line);
+            *lineEnd = '\0';
+            //blank lines are skipped, everything else produces exactly one output line
+            if (strspn(line, " \t\r") != (size_t)(lineEnd - line)) {
+                std::shared_ptr<CurveRecord> record = std::make_shared<CurveRecord>();
+                if (parseCurveRecord(line, *record)) {
+                    tessellateRecord(record, points, out);
+                }
+                else {
+                    malformedLines++;
+                    out += "0 0\n";
+                }
+            }
+            line = lineEnd + 1;
+        }
+        job->output.set_value(out);
+    }
+}
+
+//splits stdin into blocks that end on a line break and hands them to the workers, queuing their results in input order
+void reader(BoundedQueue<std::shared_ptr<Job> >* jobs, BoundedQueue<std::future<std::string> >* results) {
+    std::string carry;
+    while (true) {
+        std::string block;
+        block.swap(carry);
+        size_t used = block.size();
+        block.resize(used + blockSize + 1);
+        size_t got = fread(&block[used], 1, blockSize, stdin);
+        block.resize(used + got);
+        if (got == 0) {
+            if (block.empty()) {
+                break;
+            }
+            //last line without a line break
+            block += '\n';
+        }
+        else {
+            size_t lastNewline = block.rfind('\n');
+            if (lastNewline == std::string::npos) {
+                //a single line longer than the block, keep reading
+                carry.swap(block);
+                continue;
+            }
+            carry.assign(block, lastNewline + 1, std::string::npos);
+            block.resize(lastNewline + 1);
+        }
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->text.swap(block);
+        results->push(job->output.get_future());
+        jobs->push(job);
+        if (got == 0) {
+            break;
+        }
+    }
+    jobs->close();
+    results->close();
+}
+
+//parses a command line count between minimum and maximum. returns -1 for anything else
+long parseCount(const char* text, long minimum, long maximum) {
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || value < minimum || value > maximum) {
+        return -1;
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    long threadCount = std::thread::hardware_concurrency();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && (samplesPerCurve = parseCount(argv[i + 1], 2, 1 << 20)) != -1) {
+            i++;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && (threadCount = parseCount(argv[i + 1], 1, 1024)) != -1) {
+            i++;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n samples] [-j threads] < scene > polylines\n"
+                    "  -n  write every curve as samples points at evenly spaced parameters, at least 2\n"
+                    "  -j  number of worker threads, at least 1\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threadCount < 1) {
+        threadCount = 1;
+    }
+
+    //the result queue limits how many blocks are in flight, which bounds memory to a few blocks per worker
+    BoundedQueue<std::shared_ptr<Job> > jobs(threadCount * 2);
+    BoundedQueue<std::future<std::string> > results(threadCount * 4);
+
+    std::thread readerThread(reader, &jobs, &results);
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threadCount; i++) {
+        workers.push_back(std::thread(worker, &jobs));
+    }
+
+    std::future<std::string> result;
+    bool writeFailed = false;
+    while (results.pop(result)) {
+        std::string out = result.get();
+        if (!writeFailed && fwrite(out.data(), 1, out.size(), stdout) != out.size()) {
+            writeFailed = true;
+        }
+    }
+
+    readerThread.join();
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers.at(i).join();
+    }
+    if (fflush(stdout) != 0 || writeFailed) {
+        fprintf(stderr, "tessellate: could not write output\n");
+        return 1;
+    }
+    if (malformedLines > 0) {
+        fprintf(stderr, "tessellate: %d malformed curves written as empty polylines\n", (int)malformedLines);
+        return 1;
+    }
+    return 0;
+}
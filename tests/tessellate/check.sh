@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+#  Builds the headless tessellator and checks it on input.txt: the output must match expected.txt (and expected-n5.txt
+#  with -n 5) number by number within 1e-5, must not depend on the number of threads, and bad options must be rejected.
+#  Usage: tests/tessellate/check.sh [compiler]
+#
+here=$(cd "$(dirname "$0")" && pwd)
+compiler=${1:-${CXX:-c++}}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+"$compiler" -std=c++11 -O2 -pthread "$here/../../CurvesProject/tessellate.cpp" -o "$work/tessellate" || exit 1
+
+failures=0
+fail() {
+    echo "FAIL: $1"
+    failures=$((failures + 1))
+}
+
+#compares two polyline files line by line, allowing for rounding in the last printed digits
+compare() {
+    awk -v tolerance=1e-5 '
+        NR == FNR { expected[FNR] = $0; lines = FNR; next }
+        {
+            actual = FNR
+            n = split(expected[FNR], e, " ")
+            if (n != NF) { print "line " FNR ": " NF " fields, expected " n; bad = 1; next }
+            for (i = 1; i <= NF; i++) {
+                d = $i - e[i]
+                if (d > tolerance || d < -tolerance) { print "line " FNR " field " i ": " $i ", expected " e[i]; bad = 1; next }
+            }
+        }
+        END { if (actual != lines) { print actual + 0 " lines, expected " lines; bad = 1 } exit bad }
+    ' "$1" "$2"
+}
+
+#input.txt ends with two malformed curves, which are written as empty polylines and reported with exit status 1
+"$work/tessellate" -j 1 < "$here/input.txt" > "$work/one" 2> /dev/null
+[ $? -eq 1 ] || fail "malformed curves are reported with exit status 1"
+compare "$here/expected.txt" "$work/one" || fail "output differs from expected.txt"
+
+"$work/tessellate" -j 3 < "$here/input.txt" > "$work/three" 2> /dev/null
+cmp -s "$work/one" "$work/three" || fail "output depends on the number of threads"
+
+"$work/tessellate" -n 5 < "$here/input.txt" > "$work/five" 2> /dev/null
+compare "$here/expected-n5.txt" "$work/five" || fail "output with -n 5 differs from expected-n5.txt"
+
+for options in "-j -1" "-j 0" "-j x" "-j" "-n 1" "-n 2x" "-q"; do
+    "$work/tessellate" $options < /dev/null > /dev/null 2>&1
+    [ $? -eq 2 ] || fail "tessellate $options is rejected"
+done
+
+if [ $failures -ne 0 ]; then
+    echo "$failures checks failed"
+    exit 1
+fi
+echo "all checks passed"